@@ -1,8 +1,215 @@
 #include <benchmark/benchmark.h>
 #include "iubpatch/formats/bps.h"
+#include "iubpatch/io.h"
+#include "iubpatch/crc32.h"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 using namespace iubpatch;
 
+namespace {
+    void encode_num(std::vector<Byte>& out, std::uint64_t value) {
+        while (true) {
+            Byte x = value & 0x7F;
+            value >>= 7;
+            if (value == 0) {
+                out.push_back(0x80 | x);
+                break;
+            }
+            out.push_back(x);
+            value--;
+        }
+    }
+    
+    void encode_delta(std::vector<Byte>& out, std::int64_t delta) {
+        encode_num(out, delta < 0 ? (static_cast<std::uint64_t>(-delta) << 1) | 1 : static_cast<std::uint64_t>(delta) << 1);
+    }
+    
+    // a million small commands cycling through all four kinds against an
+    // 8MB source, the checksums are left zero
+    std::vector<Byte> make_many_commands_patch(std::size_t& source_size) {
+        source_size = 8 * 1024 * 1024;
+        std::vector<Byte> commands;
+        std::size_t produced = 0;
+        std::size_t source_rel = 0;
+        std::size_t target_rel = 0;
+        for (int i = 0; i < 250000; ++i) {
+            encode_num(commands, ((8 - 1) << 2) | 0);       // SourceRead 8
+            produced += 8;
+            encode_num(commands, ((4 - 1) << 2) | 1);       // TargetRead 4
+            commands.insert(commands.end(), {0x11, 0x22, 0x33, 0x44});
+            produced += 4;
+            std::size_t from = (source_rel + 4096) % (source_size - 8);
+            encode_num(commands, ((8 - 1) << 2) | 2);       // SourceCopy 8
+            encode_delta(commands, static_cast<std::int64_t>(from) - static_cast<std::int64_t>(source_rel));
+            source_rel = from + 8;
+            produced += 8;
+            std::size_t back = produced - 12;
+            encode_num(commands, ((4 - 1) << 2) | 3);       // TargetCopy 4
+            encode_delta(commands, static_cast<std::int64_t>(back) - static_cast<std::int64_t>(target_rel));
+            target_rel = back + 4;
+            produced += 4;
+        }
+        
+        std::vector<Byte> patch = {'B', 'P', 'S', '1'};
+        encode_num(patch, source_size);
+        encode_num(patch, produced);
+        encode_num(patch, 0);
+        patch.insert(patch.end(), commands.begin(), commands.end());
+        patch.insert(patch.end(), 12, 0);
+        return patch;
+    }
+    
+    // two million one-byte SourceCopy commands hopping around a 256KB
+    // source that stays in cache, jumps of mixed length so the offsets
+    // take 2 or 3 bytes. nearly all the work is decoding them
+    std::vector<Byte> make_wide_numbers_patch(std::size_t& source_size, std::size_t& target_size) {
+        source_size = 256 * 1024;
+        target_size = 2000000;
+        std::vector<Byte> patch = {'B', 'P', 'S', '1'};
+        encode_num(patch, source_size);
+        encode_num(patch, target_size);
+        encode_num(patch, 0);
+        std::uint32_t seed = 12345;
+        std::size_t source_rel = 0;
+        for (std::size_t i = 0; i < target_size; ++i) {
+            seed = seed * 1103515245 + 12345;
+            std::size_t jump = 64 + ((seed >> 8) & ((1u << ((seed >> 3) % 11 + 7)) - 1));
+            std::size_t from = (source_rel + jump) % (source_size - 1);
+            encode_num(patch, ((1 - 1) << 2) | 2);          // SourceCopy 1
+            encode_delta(patch, static_cast<std::int64_t>(from) - static_cast<std::int64_t>(source_rel));
+            source_rel = from + 1;
+        }
+        patch.insert(patch.end(), 12, 0);
+        return patch;
+    }
+    
+    // a 64KB TargetRead followed by 4KB TargetCopy commands, each reading
+    // from distance bytes back, up to a 32MB target
+    std::vector<Byte> make_target_copy_patch(std::size_t distance, std::size_t& target_size) {
+        constexpr std::size_t seed_size = 64 * 1024;
+        constexpr std::size_t copy_size = 4096;
+        target_size = 32 * 1024 * 1024;
+        std::vector<Byte> patch = {'B', 'P', 'S', '1'};
+        encode_num(patch, 0);
+        encode_num(patch, target_size);
+        encode_num(patch, 0);
+        encode_num(patch, ((seed_size - 1) << 2) | 1);  // TargetRead 64KB
+        for (std::size_t i = 0; i < seed_size; ++i) {
+            patch.push_back(static_cast<Byte>(i * 31 + 7));
+        }
+        std::size_t target_rel = 0;
+        for (std::size_t produced = seed_size; produced < target_size; produced += copy_size) {
+            std::size_t from = produced - distance;
+            encode_num(patch, ((copy_size - 1) << 2) | 3);  // TargetCopy 4KB
+            encode_delta(patch, static_cast<std::int64_t>(from) - static_cast<std::int64_t>(target_rel));
+            target_rel = from + copy_size;
+        }
+        patch.insert(patch.end(), 12, 0);
+        return patch;
+    }
+    
+    // something like a real ROM hack against a 16MB source: mostly
+    // unchanged runs, short inserted strings, moved blocks and repeats,
+    // with random lengths. the target checksum is filled in
+    std::vector<Byte> make_mixed_patch(std::vector<Byte>& source, std::size_t& target_size) {
+        source.resize(16 * 1024 * 1024);
+        std::uint32_t seed = 12345;
+        auto next = [&seed](std::uint32_t bound) {
+            seed = seed * 1103515245 + 12345;
+            return (seed >> 8) % bound;
+        };
+        for (auto& b : source) {
+            b = static_cast<Byte>(next(256));
+        }
+        
+        std::vector<Byte> target;
+        std::vector<Byte> commands;
+        std::size_t source_rel = 0;
+        std::size_t target_rel = 0;
+        while (target.size() < source.size() - 4096) {
+            std::uint32_t kind = next(16);
+            if (kind < 7 || target.size() < 4096) {
+                std::size_t length = 16 + next(240);    // SourceRead
+                encode_num(commands, ((length - 1) << 2) | 0);
+                target.insert(target.end(), source.begin() + target.size(), source.begin() + target.size() + length);
+            } else if (kind < 10) {
+                std::size_t length = 1 + next(24);      // TargetRead
+                encode_num(commands, ((length - 1) << 2) | 1);
+                for (std::size_t i = 0; i < length; ++i) {
+                    Byte b = static_cast<Byte>(next(256));
+                    commands.push_back(b);
+                    target.push_back(b);
+                }
+            } else if (kind < 14) {
+                std::size_t length = 4 + next(124);     // SourceCopy, mostly nearby
+                std::size_t from = std::min(source.size() - length, target.size() + next(1 << 16));
+                encode_num(commands, ((length - 1) << 2) | 2);
+                encode_delta(commands, static_cast<std::int64_t>(from) - static_cast<std::int64_t>(source_rel));
+                target.insert(target.end(), source.begin() + from, source.begin() + from + length);
+                source_rel = from + length;
+            } else {
+                std::size_t length = 2 + next(62);      // TargetCopy, runs and repeats
+                std::size_t distance = kind == 14 ? 1 : 1 + next(4096);
+                std::size_t from = target.size() - distance;
+                encode_num(commands, ((length - 1) << 2) | 3);
+                encode_delta(commands, static_cast<std::int64_t>(from) - static_cast<std::int64_t>(target_rel));
+                for (std::size_t i = 0; i < length; ++i) {
+                    target.push_back(target[from + i]);
+                }
+                target_rel = from + length;
+            }
+        }
+        target_size = target.size();
+        
+        std::vector<Byte> patch = {'B', 'P', 'S', '1'};
+        encode_num(patch, source.size());
+        encode_num(patch, target.size());
+        encode_num(patch, 0);
+        patch.insert(patch.end(), commands.begin(), commands.end());
+        for (std::uint32_t crc : {calc_crc32(source), calc_crc32(target)}) {
+            for (int i = 0; i < 4; ++i) {
+                patch.push_back(static_cast<Byte>(crc >> (8 * i)));
+            }
+        }
+        patch.insert(patch.end(), 4, 0);
+        return patch;
+    }
+    
+    // keeps streamed output in memory, so only the applier is measured
+    class MemoryWriter : public FileWriter {
+    public:
+        Result<void> write(std::span<const Byte> data) override {
+            out.insert(out.end(), data.begin(), data.end());
+            return Result<void>{};
+        }
+        Result<void> write_at(std::size_t offset, std::span<const Byte> data) override {
+            std::copy(data.begin(), data.end(), out.begin() + offset);
+            return Result<void>{};
+        }
+        Result<void> read_at(std::size_t offset, std::span<Byte> data) override {
+            std::copy_n(out.begin() + offset, data.size(), data.begin());
+            return Result<void>{};
+        }
+        Result<void> flush() override { return Result<void>{}; }
+        
+        std::vector<Byte> out;
+    };
+    
+    // heap in use right now, where the allocator can tell
+    double heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        return static_cast<double>(mallinfo2().uordblks);
+#else
+        return 0;
+#endif
+    }
+}
+
 // Benchmark BPS parsing with minimal patch
 static void BM_BPS_Parse_Minimal(benchmark::State& state) {
     std::vector<Byte> patch_data = {
@@ -43,3 +250,115 @@ static void BM_BPS_Apply_Empty(benchmark::State& state) {
     }
 }
 BENCHMARK(BM_BPS_Apply_Empty);
+
+// load + apply of the million command patch. heap_MB is what the loaded
+// patch holds on to besides the patch bytes themselves
+static void BM_BPS_LoadApply_ManyCommands(benchmark::State& state) {
+    std::size_t source_size = 0;
+    auto patch_data = make_many_commands_patch(source_size);
+    std::vector<Byte> source(source_size, 0x5A);
+    
+    PatchOptions options;
+    options.verify_checksums = false;
+    
+    double held = 0;
+    for (auto _ : state) {
+        double before = heap_in_use();
+        auto patch = BPSPatch::load(std::span<const Byte>(patch_data), nullptr);
+        held = heap_in_use() - before;
+        auto result = patch.value()->apply(source, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.counters["heap_MB"] = held / (1024 * 1024);
+    state.SetItemsProcessed(state.iterations() * 1000000);
+}
+BENCHMARK(BM_BPS_LoadApply_ManyCommands)->Unit(benchmark::kMillisecond);
+
+// apply of a patch that is almost nothing but wide variable-length numbers
+static void BM_BPS_Apply_WideNumbers(benchmark::State& state) {
+    std::size_t source_size = 0;
+    std::size_t target_size = 0;
+    auto patch_data = make_wide_numbers_patch(source_size, target_size);
+    auto patch = BPSPatch::load(std::span<const Byte>(patch_data), nullptr).value();
+    std::vector<Byte> source(source_size, 0x5A);
+    std::vector<Byte> target(target_size);
+    
+    PatchOptions options;
+    options.verify_checksums = false;
+    
+    for (auto _ : state) {
+        auto result = patch->apply_into(source, target, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * patch_data.size());
+}
+BENCHMARK(BM_BPS_Apply_WideNumbers)->Unit(benchmark::kMillisecond);
+
+// TargetCopy at a given distance: 1 and 16 are short repeat periods (run
+// length and small tiles), 1024 a long one, 65536 doesn't overlap at all
+static void BM_BPS_Apply_TargetCopy(benchmark::State& state) {
+    std::size_t target_size = 0;
+    auto patch_data = make_target_copy_patch(static_cast<std::size_t>(state.range(0)), target_size);
+    auto patch = BPSPatch::load(std::span<const Byte>(patch_data), nullptr).value();
+    std::vector<Byte> source;
+    std::vector<Byte> target(target_size);
+    
+    PatchOptions options;
+    options.verify_checksums = false;
+    
+    for (auto _ : state) {
+        auto result = patch->apply_into(source, target, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * target_size);
+}
+BENCHMARK(BM_BPS_Apply_TargetCopy)->Arg(1)->Arg(16)->Arg(1024)->Arg(65536)->Unit(benchmark::kMillisecond);
+
+// the same through apply_streaming with a 1MB window
+static void BM_BPS_Stream_TargetCopy(benchmark::State& state) {
+    std::size_t target_size = 0;
+    auto patch_data = make_target_copy_patch(static_cast<std::size_t>(state.range(0)), target_size);
+    auto patch = BPSPatch::load(std::span<const Byte>(patch_data), nullptr).value();
+    std::vector<Byte> source;
+    
+    PatchOptions options;
+    options.verify_checksums = false;
+    options.stream_window_size = 1024 * 1024;
+    
+    MemoryWriter writer;
+    writer.out.reserve(target_size);
+    for (auto _ : state) {
+        writer.out.clear();
+        auto result = patch->apply_streaming(source, writer, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * target_size);
+}
+BENCHMARK(BM_BPS_Stream_TargetCopy)->Arg(1)->Arg(16)->Arg(1024)->Arg(65536)->Unit(benchmark::kMillisecond);
+
+// the mixed patch into a presized buffer, without and with checksums
+static void BM_BPS_Apply_Mixed(benchmark::State& state) {
+    std::vector<Byte> source;
+    std::size_t target_size = 0;
+    auto patch_data = make_mixed_patch(source, target_size);
+    auto patch = BPSPatch::load(std::span<const Byte>(patch_data), nullptr).value();
+    std::vector<Byte> target(target_size);
+    
+    PatchOptions options;
+    options.verify_checksums = state.range(0) != 0;
+    
+    for (auto _ : state) {
+        auto result = patch->apply_into(source, target, options);
+        if (!result) {
+            state.SkipWithError(result.error().message.c_str());
+            break;
+        }
+    }
+    
+    state.SetBytesProcessed(state.iterations() * target_size);
+}
+BENCHMARK(BM_BPS_Apply_Mixed)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+#include "iubpatch/crc32.h"
+
+using namespace iubpatch;
+
+namespace {
+    std::vector<std::uint8_t> make_buffer(std::size_t size) {
+        std::vector<std::uint8_t> data(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<std::uint8_t>(i * 31 + 7);
+        }
+        return data;
+    }
+}
+
+// byte-at-a-time table loop (the old calc_crc32)
+static void BM_CRC32_Bytewise(benchmark::State& state) {
+    auto data = make_buffer(state.range(0));
+    
+    for (auto _ : state) {
+        auto crc = crc32_update_bytewise(0xFFFFFFFF, data);
+        benchmark::DoNotOptimize(crc);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_CRC32_Bytewise)->Arg(4 * 1024)->Arg(1024 * 1024)->Arg(32 * 1024 * 1024);
+
+// slicing-by-8
+static void BM_CRC32_Slice8(benchmark::State& state) {
+    auto data = make_buffer(state.range(0));
+    
+    for (auto _ : state) {
+        auto crc = crc32_update_slice8(0xFFFFFFFF, data);
+        benchmark::DoNotOptimize(crc);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_CRC32_Slice8)->Arg(4 * 1024)->Arg(1024 * 1024)->Arg(32 * 1024 * 1024);
+
+// slicing-by-16
+static void BM_CRC32_Slice16(benchmark::State& state) {
+    auto data = make_buffer(state.range(0));
+    
+    for (auto _ : state) {
+        auto crc = crc32_update_slice16(0xFFFFFFFF, data);
+        benchmark::DoNotOptimize(crc);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_CRC32_Slice16)->Arg(4 * 1024)->Arg(1024 * 1024)->Arg(32 * 1024 * 1024);
+
+// calc_crc32, whatever backend it picks
+static void BM_CRC32_Calc(benchmark::State& state) {
+    auto data = make_buffer(state.range(0));
+    
+    for (auto _ : state) {
+        auto crc = calc_crc32(data);
+        benchmark::DoNotOptimize(crc);
+    }
+    
+    state.SetLabel(crc32_backend_name());
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_CRC32_Calc)->Arg(4 * 1024)->Arg(1024 * 1024)->Arg(32 * 1024 * 1024);
+
+// calc_crc32_parallel scaling over a 64 MiB buffer, arg = thread count
+static void BM_CRC32_Parallel(benchmark::State& state) {
+    auto data = make_buffer(64 * 1024 * 1024);
+    unsigned threads = static_cast<unsigned>(state.range(0));
+    
+    for (auto _ : state) {
+        auto crc = calc_crc32_parallel(data, threads);
+        benchmark::DoNotOptimize(crc);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_CRC32_Parallel)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
@@ -1,8 +1,17 @@
 #include <benchmark/benchmark.h>
 #include "iubpatch/io.h"
+#include "iubpatch/apply.h"
+#include "iubpatch/formats/bps.h"
 #include <fstream>
 #include <filesystem>
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 using namespace iubpatch;
 
 namespace {
@@ -17,6 +26,19 @@ namespace {
     void cleanup_test_file() {
         std::filesystem::remove(test_file);
     }
+    
+    void encode_bps_num(std::vector<Byte>& out, std::uint64_t value) {
+        while (true) {
+            Byte x = value & 0x7F;
+            value >>= 7;
+            if (value == 0) {
+                out.push_back(0x80 | x);
+                break;
+            }
+            out.push_back(x);
+            value--;
+        }
+    }
 }
 
 // buffered file reading (small file)
@@ -132,3 +154,299 @@ static void BM_FileReader_ReadAll(benchmark::State& state) {
     state.SetBytesProcessed(state.iterations() * 1024 * 1024);
 }
 BENCHMARK(BM_FileReader_ReadAll);
+
+// the same 1MB through read_view, nothing is allocated per call
+static void BM_FileReader_ReadView(benchmark::State& state) {
+    create_test_file(1024 * 1024);  // 1MB
+    
+    for (auto _ : state) {
+        auto reader = open_file_reader(test_file);
+        if (reader.is_ok()) {
+            auto result = reader.value()->read_view(0, 1024 * 1024);
+            benchmark::DoNotOptimize(result);
+        }
+    }
+    
+    cleanup_test_file();
+    state.SetBytesProcessed(state.iterations() * 1024 * 1024);
+}
+BENCHMARK(BM_FileReader_ReadView);
+
+// end-to-end apply_patch on a 16MB source, mapped vs buffered reads
+static void BM_ApplyPatch_EndToEnd(benchmark::State& state) {
+    const bool use_mmap = state.range(0) != 0;
+    const std::size_t source_size = 16 * 1024 * 1024;
+    const char* patch_file = "/tmp/iubpatch_bench_e2e.ips";
+    const char* output_file = "/tmp/iubpatch_bench_e2e.out";
+    create_test_file(source_size);
+    
+    // a handful of small records spread over the source
+    std::vector<Byte> patch = {'P', 'A', 'T', 'C', 'H'};
+    for (std::size_t offset = 0x1000; offset < 0xFF0000; offset += 0x100000) {
+        patch.insert(patch.end(), {
+            static_cast<Byte>(offset >> 16), static_cast<Byte>(offset >> 8), static_cast<Byte>(offset),
+            0x00, 0x04, 0xDE, 0xAD, 0xBE, 0xEF
+        });
+    }
+    patch.insert(patch.end(), {'E', 'O', 'F'});
+    benchmark::DoNotOptimize(write_file(patch_file, std::span<const Byte>(patch.data(), patch.size())));
+    
+    PatchOptions options;
+    options.use_mmap = use_mmap;
+    
+    for (auto _ : state) {
+        auto result = apply_patch(patch_file, test_file, output_file, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    std::filesystem::remove(patch_file);
+    std::filesystem::remove(output_file);
+    cleanup_test_file();
+    state.SetLabel(use_mmap ? "mmap" : "buffered");
+    state.SetBytesProcessed(state.iterations() * source_size);
+}
+BENCHMARK(BM_ApplyPatch_EndToEnd)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+#if defined(__linux__) && defined(IUB_ENABLE_MMAP)
+// BPS patch of 2K or 16K SourceCopy commands, 1KB each, jumping all over
+// a 64MB source that is dropped from the page cache before every run.
+// compares the mapping left on its default advice with hints from the
+// commands. the 16K case touches most pages, there the hints stay off
+static void BM_ApplyBPS_ColdScattered(benchmark::State& state) {
+    const bool hints = state.range(0) != 0;
+    const int copies = static_cast<int>(state.range(1));
+    const std::size_t source_size = 64 * 1024 * 1024;
+    const std::size_t copy_size = 1024;
+    const char* output_file = "/tmp/iubpatch_bench_scatter.out";
+    create_test_file(source_size);
+    
+    std::vector<Byte> commands;
+    std::size_t rel_offset = 0;
+    std::uint32_t seed = 1;
+    for (int i = 0; i < copies; ++i) {
+        seed = seed * 1103515245 + 12345;
+        std::size_t offset = static_cast<std::size_t>(seed) % (source_size - copy_size);
+        std::int64_t delta = static_cast<std::int64_t>(offset) - static_cast<std::int64_t>(rel_offset);
+        encode_bps_num(commands, ((copy_size - 1) << 2) | 2);
+        encode_bps_num(commands, delta < 0 ? ((-delta) << 1) | 1 : delta << 1);
+        rel_offset = offset + copy_size;
+    }
+    std::vector<Byte> patch = {'B', 'P', 'S', '1'};
+    encode_bps_num(patch, source_size);
+    encode_bps_num(patch, copies * copy_size);
+    encode_bps_num(patch, 0);
+    patch.insert(patch.end(), commands.begin(), commands.end());
+    patch.insert(patch.end(), 12, 0);  // checksums aren't verified here
+    auto bps = BPSPatch::load(patch).value();
+    
+    PatchOptions options;
+    options.verify_checksums = false;
+    options.access_hints = hints;
+    
+    // dirty pages can't be dropped, get the file on disk first
+    int fd = ::open(test_file, O_RDONLY);
+    fsync(fd);
+    for (auto _ : state) {
+        state.PauseTiming();
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        state.ResumeTiming();
+        auto result = bps->apply_to_file(test_file, output_file, options);
+        benchmark::DoNotOptimize(result);
+    }
+    ::close(fd);
+    
+    std::filesystem::remove(output_file);
+    cleanup_test_file();
+    state.SetLabel(hints ? "hints" : "sequential");
+}
+BENCHMARK(BM_ApplyBPS_ColdScattered)->ArgsProduct({{0, 1}, {2048, 16384}})->Unit(benchmark::kMillisecond);
+#endif
+
+#if defined(__linux__)
+namespace {
+    // how much of path sits in the page cache, in bytes
+    double cached_bytes(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return 0;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            return 0;
+        }
+        long page = sysconf(_SC_PAGESIZE);
+        std::vector<unsigned char> resident((st.st_size + page - 1) / page);
+        std::size_t pages = 0;
+        if (mincore(map, st.st_size, resident.data()) == 0) {
+            for (auto r : resident) {
+                pages += r & 1;
+            }
+        }
+        munmap(map, st.st_size);
+        return static_cast<double>(pages) * page;
+    }
+}
+
+// the end-to-end IPS apply again under each PatchOptions::CacheMode. the
+// counter is what source and output leave in the page cache afterwards
+static void BM_ApplyPatch_CacheMode(benchmark::State& state) {
+    const auto mode = static_cast<PatchOptions::CacheMode>(state.range(0));
+    const std::size_t source_size = 16 * 1024 * 1024;
+    const char* patch_file = "/tmp/iubpatch_bench_cache.ips";
+    const char* output_file = "/tmp/iubpatch_bench_cache.out";
+    create_test_file(source_size);
+    
+    std::vector<Byte> patch = {'P', 'A', 'T', 'C', 'H'};
+    for (std::size_t offset = 0x1000; offset < 0xFF0000; offset += 0x100000) {
+        patch.insert(patch.end(), {
+            static_cast<Byte>(offset >> 16), static_cast<Byte>(offset >> 8), static_cast<Byte>(offset),
+            0x00, 0x04, 0xDE, 0xAD, 0xBE, 0xEF
+        });
+    }
+    patch.insert(patch.end(), {'E', 'O', 'F'});
+    benchmark::DoNotOptimize(write_file(patch_file, std::span<const Byte>(patch.data(), patch.size())));
+    
+    // start with the source on disk only, direct reads leave alone pages
+    // that are already cached
+    int fd = ::open(test_file, O_RDONLY);
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+    
+    PatchOptions options;
+    options.cache_mode = mode;
+    
+    for (auto _ : state) {
+        auto result = apply_patch(patch_file, test_file, output_file, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.counters["cached_MB"] = (cached_bytes(test_file) + cached_bytes(output_file)) / (1024 * 1024);
+    std::filesystem::remove(patch_file);
+    std::filesystem::remove(output_file);
+    cleanup_test_file();
+    const char* labels[] = {"normal", "drop_behind", "direct"};
+    state.SetLabel(labels[state.range(0)]);
+    state.SetBytesProcessed(state.iterations() * source_size);
+}
+BENCHMARK(BM_ApplyPatch_CacheMode)->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+#endif
+
+// in-place IPS on a 64MB file touching 40KB, sparse clone+pwrite vs a
+// full rewrite
+static void BM_ApplyInPlace_IPS(benchmark::State& state) {
+    const bool sparse = state.range(0) != 0;
+    const char* patch_file = "/tmp/iubpatch_bench_inplace.ips";
+    create_test_file(64 * 1024 * 1024);
+    
+    // 40 records of 1KB spread over the file
+    std::vector<Byte> patch = {'P', 'A', 'T', 'C', 'H'};
+    for (std::size_t i = 0; i < 40; ++i) {
+        std::size_t offset = i * 0x60000;
+        patch.insert(patch.end(), {
+            static_cast<Byte>(offset >> 16), static_cast<Byte>(offset >> 8), static_cast<Byte>(offset),
+            0x04, 0x00
+        });
+        patch.insert(patch.end(), 1024, static_cast<Byte>(i));
+    }
+    patch.insert(patch.end(), {'E', 'O', 'F'});
+    benchmark::DoNotOptimize(write_file(patch_file, std::span<const Byte>(patch.data(), patch.size())));
+    
+    PatchOptions options;
+    options.sparse_inplace = sparse ? PatchOptions::SparseInPlace::Always : PatchOptions::SparseInPlace::Off;
+    
+    for (auto _ : state) {
+        auto result = apply_patch_inplace(patch_file, test_file, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    std::filesystem::remove(patch_file);
+    cleanup_test_file();
+    state.SetLabel(sparse ? "sparse" : "rewrite");
+}
+BENCHMARK(BM_ApplyInPlace_IPS)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// 64MB backup per strategy, on the regular /tmp filesystem and on tmpfs.
+// a strategy the filesystem lacks falls through to the next one, the
+// label says which one actually ran
+static void BM_CreateBackup(benchmark::State& state) {
+    const bool tmpfs = state.range(0) != 0;
+    const auto first = static_cast<CopyMethod>(state.range(1));
+    std::string dir = tmpfs ? "/dev/shm" : "/tmp";
+    if (!std::filesystem::is_directory(dir)) {
+        state.SkipWithError("no such directory");
+        return;
+    }
+    std::string src = dir + "/iubpatch_bench_backup.bin";
+    std::string dst = src + ".bak";
+    Bytes data(64 * 1024 * 1024, 0xAA);
+    benchmark::DoNotOptimize(write_file(src, std::span<const Byte>(data.data(), data.size())));
+    
+    CopyMethod used = first;
+    for (auto _ : state) {
+        auto result = clone_file(src, dst, first);
+        if (result) {
+            used = result.value();
+        }
+        benchmark::DoNotOptimize(result);
+    }
+    
+    std::filesystem::remove(src);
+    std::filesystem::remove(dst);
+    state.SetBytesProcessed(state.iterations() * data.size());
+    state.SetLabel(std::string(tmpfs ? "tmpfs/" : "disk/") + copy_method_to_string(used));
+}
+BENCHMARK(BM_CreateBackup)->ArgsProduct({{0, 1}, {0, 1, 2}})->Unit(benchmark::kMillisecond);
+
+#ifdef IUB_ENABLE_IO_URING
+// 10MB read through io_uring, compare with BM_BufferedRead_Large
+static void BM_UringRead_Large(benchmark::State& state) {
+    if (!io_uring_available()) {
+        state.SkipWithError("io_uring not available");
+        return;
+    }
+    create_test_file(10 * 1024 * 1024);
+    
+    for (auto _ : state) {
+        auto reader = UringFileReader::open(test_file);
+        if (reader.is_ok()) {
+            benchmark::DoNotOptimize(reader.value()->data());
+        }
+    }
+    
+    cleanup_test_file();
+    state.SetBytesProcessed(state.iterations() * 10 * 1024 * 1024);
+}
+BENCHMARK(BM_UringRead_Large);
+
+// 10MB written through io_uring in 64KB pieces, like a streaming applier
+// would, compare with the same pattern on the buffered writer
+static void BM_ChunkedWrite_Large(benchmark::State& state) {
+    const bool use_uring = state.range(0) != 0;
+    if (use_uring && !io_uring_available()) {
+        state.SkipWithError("io_uring not available");
+        return;
+    }
+    std::vector<Byte> chunk(64 * 1024, 0xBB);
+    
+    for (auto _ : state) {
+        PatchOptions options;
+        options.use_io_uring = use_uring;
+        auto writer = create_file_writer(test_file, options);
+        for (int i = 0; i < 160; ++i) {
+            benchmark::DoNotOptimize(writer.value()->write(chunk));
+        }
+        benchmark::DoNotOptimize(writer.value()->flush());
+    }
+    
+    cleanup_test_file();
+    state.SetLabel(use_uring ? "io_uring" : "buffered");
+    state.SetBytesProcessed(state.iterations() * 160 * chunk.size());
+}
+BENCHMARK(BM_ChunkedWrite_Large)->Arg(0)->Arg(1);
+#endif
@@ -123,3 +123,63 @@ static void BM_IPS_Apply_MultipleRecords(benchmark::State& state) {
     state.SetBytesProcessed(state.iterations() * source.size());
 }
 BENCHMARK(BM_IPS_Apply_MultipleRecords);
+
+// a big hack: 50K records over a 4MB ROM, mostly 32 byte data records
+// with every eighth one RLE. in order, or scattered at random so that
+// they overlap and later ones have to win
+static std::vector<Byte> make_many_records_patch(bool scattered = false) {
+    std::vector<Byte> patch_data = {'P', 'A', 'T', 'C', 'H'};
+    std::uint32_t seed = 12345;
+    for (std::uint32_t i = 0; i < 50000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        std::uint32_t offset = scattered ? (seed >> 4) % 0x3FFF00 : (i * 83) % 0x3FFF00;
+        patch_data.insert(patch_data.end(), {
+            static_cast<Byte>(offset >> 16), static_cast<Byte>(offset >> 8), static_cast<Byte>(offset)
+        });
+        if (i % 8 == 0) {
+            patch_data.insert(patch_data.end(), {0x00, 0x00, 0x00, 0x40, static_cast<Byte>(i)});
+        } else {
+            patch_data.insert(patch_data.end(), {0x00, 0x20});
+            patch_data.insert(patch_data.end(), 32, static_cast<Byte>(i));
+        }
+    }
+    patch_data.insert(patch_data.end(), {'E', 'O', 'F'});
+    return patch_data;
+}
+
+static void BM_IPS_Parse_ManyRecords(benchmark::State& state) {
+    auto patch_data = make_many_records_patch(state.range(0) != 0);
+    
+    for (auto _ : state) {
+        auto result = IPSPatch::load(std::span<const Byte>(patch_data), nullptr);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetItemsProcessed(state.iterations() * 50000);
+}
+BENCHMARK(BM_IPS_Parse_ManyRecords)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// the same patch applied onto a 4MB ROM
+static void BM_IPS_Apply_ManyRecords(benchmark::State& state) {
+    auto patch = IPSPatch::load(make_many_records_patch(state.range(0) != 0)).value();
+    std::vector<Byte> source(4 * 1024 * 1024, 0x5A);
+    std::vector<Byte> target(patch->output_size(source).value());
+    
+    for (auto _ : state) {
+        auto result = patch->apply_into(source, target);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * target.size());
+}
+BENCHMARK(BM_IPS_Apply_ManyRecords)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+static void BM_IPS_Metadata_ManyRecords(benchmark::State& state) {
+    auto patch = IPSPatch::load(make_many_records_patch()).value();
+    
+    for (auto _ : state) {
+        auto result = patch->get_metadata();
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_IPS_Metadata_ManyRecords);
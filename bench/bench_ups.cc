@@ -1,8 +1,67 @@
 #include <benchmark/benchmark.h>
 #include "iubpatch/formats/ups.h"
+#include <cstdint>
 
 using namespace iubpatch;
 
+namespace {
+    void encode_num(std::vector<Byte>& out, std::uint64_t value) {
+        while (true) {
+            Byte x = value & 0x7F;
+            value >>= 7;
+            if (value == 0) {
+                out.push_back(0x80 | x);
+                break;
+            }
+            out.push_back(x);
+            value--;
+        }
+    }
+    
+    constexpr std::size_t dense_target_size = 64 * 1024 * 1024;
+    
+    // a hunk of range(0) changed bytes every 2 * range(0) bytes over the
+    // whole 64MB target, the checksums are left zero
+    std::vector<Byte> make_dense_patch(std::size_t hunk) {
+        std::vector<Byte> patch = {'U', 'P', 'S', '1'};
+        encode_num(patch, dense_target_size);
+        encode_num(patch, dense_target_size);
+        patch.reserve(dense_target_size / 2 + dense_target_size / hunk + 64);
+        for (std::size_t at = 0; at + 2 * hunk <= dense_target_size; at += 2 * hunk) {
+            // the gap before this hunk, minus the previous terminator
+            encode_num(patch, at == 0 ? hunk : hunk - 1);
+            for (std::size_t i = 0; i < hunk; ++i) {
+                patch.push_back(static_cast<Byte>((i % 255) + 1));
+            }
+            patch.push_back(0x00);
+        }
+        patch.insert(patch.end(), 12, 0);
+        return patch;
+    }
+    
+    // a million one-byte hunks with gaps of up to 2MB between them,
+    // so parsing is mostly decoding the 1-4 byte relative offsets
+    std::vector<Byte> make_wide_gaps_patch() {
+        std::vector<Byte> hunks;
+        std::uint32_t seed = 12345;
+        std::uint64_t target_size = 0;
+        for (int i = 0; i < 1000000; ++i) {
+            seed = seed * 1103515245 + 12345;
+            std::uint64_t gap = (seed >> 8) & ((1u << ((seed >> 3) % 22)) - 1);
+            encode_num(hunks, gap);
+            hunks.push_back(0x01);
+            hunks.push_back(0x00);
+            target_size += gap + 2;
+        }
+        std::vector<Byte> patch = {'U', 'P', 'S', '1'};
+        encode_num(patch, target_size);
+        encode_num(patch, target_size);
+        patch.insert(patch.end(), hunks.begin(), hunks.end());
+        patch.insert(patch.end(), 12, 0);
+        return patch;
+    }
+}
+
 // UPS parsing with minimal patch
 static void BM_UPS_Parse_Minimal(benchmark::State& state) {
     std::vector<Byte> patch_data = {
@@ -41,3 +100,47 @@ static void BM_UPS_Apply_Empty(benchmark::State& state) {
     }
 }
 BENCHMARK(BM_UPS_Apply_Empty);
+
+// parse of a patch full of dense hunks, mostly finding terminators
+static void BM_UPS_Parse_DenseHunks(benchmark::State& state) {
+    auto patch_data = make_dense_patch(static_cast<std::size_t>(state.range(0)));
+    
+    for (auto _ : state) {
+        auto result = UPSPatch::load(std::span<const Byte>(patch_data), nullptr);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * patch_data.size());
+}
+BENCHMARK(BM_UPS_Parse_DenseHunks)->Arg(32)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+// parse of a patch where the variable-length offsets dominate
+static void BM_UPS_Parse_WideGaps(benchmark::State& state) {
+    auto patch_data = make_wide_gaps_patch();
+    
+    for (auto _ : state) {
+        auto result = UPSPatch::load(std::span<const Byte>(patch_data), nullptr);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * patch_data.size());
+}
+BENCHMARK(BM_UPS_Parse_WideGaps)->Unit(benchmark::kMillisecond);
+
+// apply of the same patch against a 64MB source, XOR-ing half of it
+static void BM_UPS_Apply_DenseHunks(benchmark::State& state) {
+    auto patch = UPSPatch::load(make_dense_patch(static_cast<std::size_t>(state.range(0)))).value();
+    std::vector<Byte> source(dense_target_size, 0x5A);
+    std::vector<Byte> target(dense_target_size);
+    
+    PatchOptions options;
+    options.verify_checksums = false;
+    
+    for (auto _ : state) {
+        auto result = patch->apply_into(source, target, options);
+        benchmark::DoNotOptimize(result);
+    }
+    
+    state.SetBytesProcessed(state.iterations() * dense_target_size);
+}
+BENCHMARK(BM_UPS_Apply_DenseHunks)->Arg(32)->Arg(1024)->Unit(benchmark::kMillisecond);
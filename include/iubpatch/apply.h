@@ -2,6 +2,7 @@
 
 #include "iubpatch/api.h"
 #include "iubpatch/errors.h"
+#include "iubpatch/io.h"
 #include "iubpatch/options.h"
 #include "iubpatch/patch.h"
 #include <string>
@@ -29,7 +30,14 @@ IUBPATCH_API Result<void> validate_patch(
 
 IUBPATCH_API Result<PatchMetadata> get_patch_info(const std::string& patch_path);
 
-IUBPATCH_API Result<std::string> create_backup(const std::string& file_path, const PatchOptions& options);
+// copies file_path next to itself with options.backup_suffix through
+// clone_file, so a backup on a reflink filesystem costs no data blocks.
+// method, if given, receives the strategy that was used
+IUBPATCH_API Result<std::string> create_backup(
+    const std::string& file_path,
+    const PatchOptions& options,
+    CopyMethod* method = nullptr
+);
 IUBPATCH_API Result<void> verify_output(const std::string& output_path);
 
 } // namespace iubpatch
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "iubpatch/api.h"
+#include "iubpatch/errors.h"
+#include "iubpatch/io.h"
+#include "iubpatch/options.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace iubpatch {
+
+// on-disk map from FileIdentity to the crc32 of that file, so the same base
+// image doesn't get hashed again for every patch applied against it.
+// updates rewrite the whole file to a temp name and rename it over the old
+// one, concurrent processes may drop each other's entries but never see a
+// torn cache
+class IUBPATCH_API ChecksumCache {
+public:
+    explicit ChecksumCache(std::string path);
+    
+    // options.checksum_cache_path, or a file in the per-user cache directory
+    static std::string path_for(const PatchOptions& options);
+    
+    std::optional<std::uint32_t> lookup(const FileIdentity& id) const;
+    
+    Result<void> store(const FileIdentity& id, std::uint32_t crc) const;
+    
+    const std::string& path() const noexcept {
+        return path_;
+    }
+    
+private:
+    std::string path_;
+};
+
+// crc32 of a whole file, served from the cache when options.use_checksum_cache
+// is set and the file hasn't changed since it was last hashed
+IUBPATCH_API Result<std::uint32_t> file_crc32(const std::string& path, const PatchOptions& options = {});
+
+// the cached crc32 of path, when options verify checksums through the cache
+// and path hasn't changed since. saves hashing an unchanged source again
+IUBPATCH_API std::optional<std::uint32_t> cached_file_crc32(const std::string& path, const PatchOptions& options);
+
+// remembers that path hashed to crc for cached_file_crc32. before is what
+// path was when it started being read, nothing is stored if it has changed
+// since. failing to write the cache is not reported
+IUBPATCH_API void store_file_crc32(
+    const std::string& path,
+    const FileIdentity& before,
+    std::uint32_t crc,
+    const PatchOptions& options
+);
+
+} // namespace iubpatch
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <future>
 #include <vector>
 #include <span>
 
+#include "iubpatch/api.h"
+
 namespace iubpatch {
 
 // CRC32 table
@@ -43,16 +48,152 @@ static const std::uint32_t crc32_table[256] = {
     0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-inline std::uint32_t calc_crc32(std::span<const std::uint8_t> data) {
-    std::uint32_t crc = 0xFFFFFFFF;
+namespace detail {
+
+inline constexpr std::uint32_t crc32_poly = 0xEDB88320;
+
+// tables for slicing-by-N, table[0] is the classic byte table and
+// table[k][b] is the crc of byte b followed by k zero bytes
+template<std::size_t N>
+constexpr std::array<std::array<std::uint32_t, 256>, N> make_crc32_tables() {
+    std::array<std::array<std::uint32_t, 256>, N> tables{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? crc32_poly : 0);
+        }
+        tables[0][i] = crc;
+    }
+    for (std::size_t k = 1; k < N; ++k) {
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t prev = tables[k - 1][i];
+            tables[k][i] = tables[0][prev & 0xFF] ^ (prev >> 8);
+        }
+    }
+    return tables;
+}
+
+inline constexpr auto crc32_slicing_tables = make_crc32_tables<16>();
+
+static_assert(crc32_slicing_tables[0][1] == 0x77073096 &&
+              crc32_slicing_tables[0][255] == 0x2d02ef8d,
+              "generated CRC32 table does not match crc32_table");
+
+inline std::uint32_t load_le32(const std::uint8_t* p) {
+    return static_cast<std::uint32_t>(p[0]) |
+           (static_cast<std::uint32_t>(p[1]) << 8) |
+           (static_cast<std::uint32_t>(p[2]) << 16) |
+           (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+} // namespace detail
+
+// the crc32_update_* functions work on the raw register, callers do the
+// 0xFFFFFFFF pre/post inversion (see calc_crc32)
+
+// reference byte-at-a-time loop
+inline std::uint32_t crc32_update_bytewise(std::uint32_t crc, std::span<const std::uint8_t> data) {
     for (std::uint8_t b : data) {
         crc = crc32_table[(crc ^ b) & 0xFF] ^ (crc >> 8);
     }
-    return crc ^ 0xFFFFFFFF;
+    return crc;
+}
+
+inline std::uint32_t crc32_update_slice8(std::uint32_t crc, std::span<const std::uint8_t> data) {
+    const auto& t = detail::crc32_slicing_tables;
+    const std::uint8_t* p = data.data();
+    std::size_t n = data.size();
+
+    while (n >= 8) {
+        std::uint32_t one = crc ^ detail::load_le32(p);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        p += 8;
+        n -= 8;
+    }
+    return crc32_update_bytewise(crc, {p, n});
+}
+
+inline std::uint32_t crc32_update_slice16(std::uint32_t crc, std::span<const std::uint8_t> data) {
+    const auto& t = detail::crc32_slicing_tables;
+    const std::uint8_t* p = data.data();
+    std::size_t n = data.size();
+
+    while (n >= 16) {
+        std::uint32_t one = crc ^ detail::load_le32(p);
+        crc = t[15][one & 0xFF] ^ t[14][(one >> 8) & 0xFF] ^
+              t[13][(one >> 16) & 0xFF] ^ t[12][one >> 24] ^
+              t[11][p[4]] ^ t[10][p[5]] ^ t[9][p[6]] ^ t[8][p[7]] ^
+              t[7][p[8]] ^ t[6][p[9]] ^ t[5][p[10]] ^ t[4][p[11]] ^
+              t[3][p[12]] ^ t[2][p[13]] ^ t[1][p[14]] ^ t[0][p[15]];
+        p += 16;
+        n -= 16;
+    }
+    return crc32_update_slice8(crc, {p, n});
+}
+
+// fastest backend for this cpu, picked once at runtime: carry-less multiply
+// folding on x86-64 (PCLMULQDQ), CRC32 instructions on ARMv8, otherwise
+// slicing-by-16
+IUBPATCH_API std::uint32_t crc32_update(std::uint32_t crc, std::span<const std::uint8_t> data);
+
+// name of the backend crc32_update dispatches to
+IUBPATCH_API const char* crc32_backend_name() noexcept;
+
+inline std::uint32_t calc_crc32(std::span<const std::uint8_t> data) {
+    return crc32_update(0xFFFFFFFF, data) ^ 0xFFFFFFFF;
 }
 
 inline std::uint32_t calc_crc32(const std::vector<std::uint8_t>& data) {
     return calc_crc32(std::span<const std::uint8_t>(data));
 }
 
+// calc_crc32 split across up to `threads` threads (0 = one per hardware
+// thread), the partial crcs are merged with crc32_combine. small buffers
+// are hashed on the calling thread
+IUBPATCH_API std::uint32_t calc_crc32_parallel(std::span<const std::uint8_t> data, unsigned threads);
+
+// runs calc_crc32_parallel on a background thread so hashing can overlap
+// other work, the data must stay alive until the future is ready
+IUBPATCH_API std::future<std::uint32_t> calc_crc32_async(std::span<const std::uint8_t> data, unsigned threads);
+
+// crc of A+B from crc(A), crc(B) and the length of B, without touching the data
+IUBPATCH_API std::uint32_t crc32_combine(std::uint32_t crc_a, std::uint32_t crc_b, std::uint64_t len_b);
+
+// incremental crc32, feeding data in any number of chunks gives the same
+// value calc_crc32 would over the concatenation
+class Crc32 {
+public:
+    Crc32() = default;
+
+    void update(std::span<const std::uint8_t> data) {
+        state_ = crc32_update(state_, data);
+        size_ += data.size();
+    }
+
+    // append the bytes another accumulator has seen, as if they followed ours
+    void combine(const Crc32& other) {
+        state_ = crc32_combine(finalize(), other.finalize(), other.size_) ^ 0xFFFFFFFF;
+        size_ += other.size_;
+    }
+
+    std::uint32_t finalize() const noexcept {
+        return state_ ^ 0xFFFFFFFF;
+    }
+
+    std::uint64_t size() const noexcept {
+        return size_;
+    }
+
+    void reset() noexcept {
+        state_ = 0xFFFFFFFF;
+        size_ = 0;
+    }
+
+private:
+    std::uint32_t state_ = 0xFFFFFFFF;
+    std::uint64_t size_ = 0;
+};
+
 } // namespace iubpatch
@@ -37,6 +37,7 @@ enum class ErrorCode {
     
     // misc
     InvalidArgument,
+    NotSupported,
     UnknownError
 };
 
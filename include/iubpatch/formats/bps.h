@@ -8,9 +8,20 @@ namespace iubpatch {
 // BPS (Binary Patching System) format
 class IUBPATCH_API BPSPatch : public Patch {
 public:
-    static Result<std::unique_ptr<BPSPatch>> load(const Bytes& patch_data);
+    // verify_patch_crc checks the patch's own crc while it is being parsed,
+    // so a separate validate() pass isn't needed
+    static Result<std::unique_ptr<BPSPatch>> load(const Bytes& patch_data, bool verify_patch_crc = false);
 
-    static Result<std::unique_ptr<BPSPatch>> load_from_file(const std::string& path);
+    // parses patch_data in place without copying it, owner is held for the
+    // lifetime of the patch to keep that memory valid (e.g. the FileReader
+    // from open_file_reader)
+    static Result<std::unique_ptr<BPSPatch>> load(
+        std::span<const Byte> patch_data,
+        std::shared_ptr<const void> owner,
+        bool verify_patch_crc = false
+    );
+
+    static Result<std::unique_ptr<BPSPatch>> load_from_file(const std::string& path, const PatchOptions& options = {});
     
     ~BPSPatch() override;
     
@@ -20,7 +31,26 @@ public:
 
     Result<PatchMetadata> get_metadata() const override;
 
-    Result<Bytes> apply(const Bytes& source, const PatchOptions& options = {}) const override;
+    using Patch::apply;
+
+    Result<Bytes> apply(std::span<const Byte> source, const PatchOptions& options = {}) const override;
+
+    Result<std::size_t> output_size(std::span<const Byte> source) const override;
+
+    Result<void> apply_into(
+        std::span<const Byte> source,
+        std::span<Byte> target,
+        const PatchOptions& options = {}
+    ) const override;
+    
+    // writes the target to writer as it is produced instead of building it
+    // in memory, only options.stream_window_size bytes of recent output are
+    // kept. TargetCopy reaching further back reads it back from writer
+    Result<void> apply_streaming(
+        std::span<const Byte> source,
+        FileWriter& writer,
+        const PatchOptions& options
+    ) const;
     
     Result<void> apply_to_file(
         const std::string& source_path,
@@ -10,7 +10,12 @@ class IUBPATCH_API IPSPatch : public Patch {
 public:
     static Result<std::unique_ptr<IPSPatch>> load(const Bytes& patch_data);
 
-    static Result<std::unique_ptr<IPSPatch>> load_from_file(const std::string& path);
+    // parses patch_data in place without copying it, owner is held for the
+    // lifetime of the patch to keep that memory valid (e.g. the FileReader
+    // from open_file_reader)
+    static Result<std::unique_ptr<IPSPatch>> load(std::span<const Byte> patch_data, std::shared_ptr<const void> owner);
+
+    static Result<std::unique_ptr<IPSPatch>> load_from_file(const std::string& path, const PatchOptions& options = {});
     
     ~IPSPatch() override;
     
@@ -20,7 +25,17 @@ public:
 
     Result<PatchMetadata> get_metadata() const override;
 
-    Result<Bytes> apply(const Bytes& source, const PatchOptions& options = {}) const override;
+    using Patch::apply;
+
+    Result<Bytes> apply(std::span<const Byte> source, const PatchOptions& options = {}) const override;
+
+    Result<std::size_t> output_size(std::span<const Byte> source) const override;
+
+    Result<void> apply_into(
+        std::span<const Byte> source,
+        std::span<Byte> target,
+        const PatchOptions& options = {}
+    ) const override;
     
     Result<void> apply_to_file(
         const std::string& source_path,
@@ -28,6 +43,8 @@ public:
         const PatchOptions& options = {}
     ) const override;
 
+    Result<void> apply_in_place(const std::string& file_path, const PatchOptions& options = {}) const override;
+
     Result<void> validate() const override;
 
     const char* format_name() const noexcept override { return "IPS"; }
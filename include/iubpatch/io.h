@@ -5,15 +5,26 @@
 #include <string>
 #include <memory>
 #include <span>
+#include <functional>
 
 #include "iubpatch/api.h"
 #include "iubpatch/errors.h"
+#include "iubpatch/options.h"
 
 namespace iubpatch {
 
 using Byte = std::uint8_t;
 using Bytes = std::vector<Byte>;
 
+// how a range of a reader is about to be read. mapped readers pass it on
+// to the kernel (madvise), the others have nothing to tune and ignore it
+enum class AccessHint {
+    Normal,
+    Sequential,
+    Random,     // no readahead, the pages are wanted one at a time
+    WillNeed    // start loading the range now, it is read shortly
+};
+
 class IUBPATCH_API FileReader {
 public:
     virtual ~FileReader() = default;
@@ -24,9 +35,20 @@ public:
     
     virtual Result<Bytes> read_range(std::size_t offset, std::size_t length) = 0;
     
+    // same bytes as read_range without the copy, the span points into the
+    // reader and is valid for as long as the reader is
+    virtual Result<std::span<const Byte>> read_view(std::size_t offset, std::size_t length) = 0;
+    
     virtual const Byte* data() const = 0;
     
     virtual bool is_mapped() const noexcept = 0;
+    
+    // only a hint, ranges past the end are clipped
+    virtual void advise(std::size_t offset, std::size_t length, AccessHint hint) {
+        static_cast<void>(offset);
+        static_cast<void>(length);
+        static_cast<void>(hint);
+    }
 };
 
 class IUBPATCH_API FileWriter {
@@ -37,14 +59,25 @@ public:
     
     virtual Result<void> write_at(std::size_t offset, std::span<const Byte> data) = 0;
     
+    // reads back bytes that were already written, for appliers that stream
+    // their output and later need to look at it again
+    virtual Result<void> read_at(std::size_t offset, std::span<Byte> out) = 0;
+    
     virtual Result<void> flush() = 0;
+    
+    // flushes and lets go of the file, reporting what only shows up when
+    // it is closed. nothing may be written after it
+    virtual Result<void> close() { return flush(); }
 };
 
 // use mmap if possible for reading, otherwise falls back to BufferedFileReader
 // still no idea if this is even needed since most roms & patches are small anyways
 class IUBPATCH_API MappedFileReader : public FileReader {
 public:
-    static Result<std::unique_ptr<MappedFileReader>> open(const std::string& path);
+    // populate faults the whole file in while mapping (MAP_POPULATE),
+    // huge_pages asks for transparent huge pages. both are best effort and
+    // only do something on Linux
+    static Result<std::unique_ptr<MappedFileReader>> open(const std::string& path, bool populate = false, bool huge_pages = false);
 
     ~MappedFileReader() override;
     
@@ -54,12 +87,17 @@ public:
 
     Result<Bytes> read_range(std::size_t offset, std::size_t length) override;
 
+    Result<std::span<const Byte>> read_view(std::size_t offset, std::size_t length) override;
+
     const Byte* data() const override;
 
     bool is_mapped() const noexcept override {
         return true;
     }
     
+    // the mapping starts out as Sequential
+    void advise(std::size_t offset, std::size_t length, AccessHint hint) override;
+    
 private:
     MappedFileReader();
     class Impl;
@@ -69,16 +107,23 @@ private:
 // usual buffered file reader incase mmap does not work or is not preferred
 class IUBPATCH_API BufferedFileReader : public FileReader {
 public:
-    static Result<std::unique_ptr<BufferedFileReader>> open(const std::string& path);
+    // buffer_size sizes the stream buffer, 0 keeps the library default
+    static Result<std::unique_ptr<BufferedFileReader>> open(const std::string& path, std::size_t buffer_size = 0);
 
     ~BufferedFileReader() override;
     
     Result<Bytes> read_all() override;
 
+    // hands over the file contents without copying them, the reader is
+    // empty afterwards
+    Bytes take_all();
+
     Result<std::size_t> size() const override;
 
     Result<Bytes> read_range(std::size_t offset, std::size_t length) override;
 
+    Result<std::span<const Byte>> read_view(std::size_t offset, std::size_t length) override;
+
     const Byte* data() const override;
 
     bool is_mapped() const noexcept override {
@@ -91,31 +136,236 @@ private:
     std::unique_ptr<Impl> impl_;
 };
 
+// reads the whole file with O_DIRECT into an aligned buffer, so none of it
+// passes through the page cache. fails with NotSupported where the platform
+// or the filesystem (tmpfs, some network mounts) has no direct I/O
+class IUBPATCH_API DirectFileReader : public FileReader {
+public:
+    static Result<std::unique_ptr<DirectFileReader>> open(const std::string& path);
+
+    ~DirectFileReader() override;
+    
+    Result<Bytes> read_all() override;
+
+    Result<std::size_t> size() const override;
+
+    Result<Bytes> read_range(std::size_t offset, std::size_t length) override;
+
+    Result<std::span<const Byte>> read_view(std::size_t offset, std::size_t length) override;
+
+    const Byte* data() const override;
+
+    bool is_mapped() const noexcept override {
+        return false;
+    }
+    
+private:
+    DirectFileReader();
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
 // buffered file writer
 class IUBPATCH_API BufferedFileWriter : public FileWriter {
 public:
-    static Result<std::unique_ptr<BufferedFileWriter>> create(const std::string& path);
+    // buffer_size sizes the stream buffer, 0 keeps the library default
+    static Result<std::unique_ptr<BufferedFileWriter>> create(const std::string& path, std::size_t buffer_size = 0);
+
+    // writes into an existing file, keeping what isn't overwritten
+    static Result<std::unique_ptr<BufferedFileWriter>> open_existing(const std::string& path, std::size_t buffer_size = 0);
 
     ~BufferedFileWriter() override;
     
     Result<void> write(std::span<const Byte> data) override;
 
     Result<void> write_at(std::size_t offset, std::span<const Byte> data) override;
+
+    Result<void> read_at(std::size_t offset, std::span<Byte> out) override;
     
     Result<void> flush() override;
     
+    Result<void> close() override;
+    
 private:
     BufferedFileWriter();
     class Impl;
     std::unique_ptr<Impl> impl_;
 };
 
+// writes straight into a shared mapping of the output file, which is sized
+// up front so the whole target can be produced in place
+class IUBPATCH_API MappedFileWriter : public FileWriter {
+public:
+    // creates (or truncates) path, sizes it to exactly size bytes and maps it
+    static Result<std::unique_ptr<MappedFileWriter>> create(const std::string& path, std::size_t size);
+
+    ~MappedFileWriter() override;
+    
+    // writes at the current position, which starts at 0 and follows write()
+    Result<void> write(std::span<const Byte> data) override;
+
+    Result<void> write_at(std::size_t offset, std::span<const Byte> data) override;
+
+    Result<void> read_at(std::size_t offset, std::span<Byte> out) override;
+    
+    // msync, the pages reach the file on unmap either way
+    Result<void> flush() override;
+    
+    Byte* data();
+
+    std::size_t size() const noexcept;
+    
+private:
+    MappedFileWriter();
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// false unless built with IUB_ENABLE_IO_URING and the running kernel (and
+// any seccomp policy) lets us set up a ring, checked once
+IUBPATCH_API bool io_uring_available() noexcept;
+
+#ifdef IUB_ENABLE_IO_URING
+// reads the whole file through io_uring in chunk_size pieces into a
+// registered buffer. open() only queues the reads, so the next file can be
+// loading while the current one is patched. read_range waits for just the
+// chunks it covers, data() and read_all() for all of them
+class IUBPATCH_API UringFileReader : public FileReader {
+public:
+    static Result<std::unique_ptr<UringFileReader>> open(const std::string& path, std::size_t chunk_size = 65536);
+
+    ~UringFileReader() override;
+    
+    // waits for every queued read, reports the first failure
+    Result<void> wait();
+    
+    Result<Bytes> read_all() override;
+
+    Result<std::size_t> size() const override;
+
+    Result<Bytes> read_range(std::size_t offset, std::size_t length) override;
+
+    Result<std::span<const Byte>> read_view(std::size_t offset, std::size_t length) override;
+
+    // nullptr if a read failed, wait() says why
+    const Byte* data() const override;
+
+    bool is_mapped() const noexcept override {
+        return false;
+    }
+    
+private:
+    UringFileReader();
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// queues writes on io_uring from a set of registered slot_size staging
+// buffers and returns as soon as the data is copied in. a write over bytes
+// that are still in flight waits for those first, so the last write wins
+// like with any other writer. a failed write shows up on a later call, at
+// the latest on flush()
+class IUBPATCH_API UringFileWriter : public FileWriter {
+public:
+    static Result<std::unique_ptr<UringFileWriter>> create(const std::string& path, std::size_t slot_size = 65536);
+
+    ~UringFileWriter() override;
+    
+    Result<void> write(std::span<const Byte> data) override;
+
+    Result<void> write_at(std::size_t offset, std::span<const Byte> data) override;
+
+    Result<void> read_at(std::size_t offset, std::span<Byte> out) override;
+    
+    // waits for every queued write
+    Result<void> flush() override;
+    
+    Result<void> close() override;
+    
+private:
+    UringFileWriter();
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+#endif
+
+// what identifies one version of a file on disk, used to key cached checksums
+struct IUBPATCH_API FileIdentity {
+    std::uint64_t device = 0;
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+
+    bool operator==(const FileIdentity&) const = default;
+};
+
+IUBPATCH_API Result<FileIdentity> get_file_identity(const std::string& path);
+
 IUBPATCH_API Result<std::unique_ptr<FileReader>> open_file_reader(const std::string& path, bool prefer_mmap = true);
 
+// maps the file when options.use_mmap is set and it fits under
+// options.max_mmap_size (0 = no limit), otherwise reads it through
+// io_uring if options.use_io_uring asks for it (returning with the reads
+// still in flight) or a stream buffer of options.io_buffer_size. a
+// cache_mode other than Normal reads it into memory with O_DIRECT or
+// drops it from the cache right after
+IUBPATCH_API Result<std::unique_ptr<FileReader>> open_file_reader(const std::string& path, const PatchOptions& options);
+
 IUBPATCH_API Result<std::unique_ptr<FileWriter>> create_file_writer(const std::string& path);
 
+// with options.cache_mode other than Normal the file is evicted from the
+// page cache on flush(), streamed writes never go through O_DIRECT
+IUBPATCH_API Result<std::unique_ptr<FileWriter>> create_file_writer(const std::string& path, const PatchOptions& options);
+
 IUBPATCH_API Result<Bytes> read_file(const std::string& path);
 
 IUBPATCH_API Result<void> write_file(const std::string& path, std::span<const Byte> data);
 
+IUBPATCH_API Result<void> write_file(const std::string& path, std::span<const Byte> data, const PatchOptions& options);
+
+// how clone_file got the bytes across, cheapest first
+enum class CopyMethod {
+    Clone,          // FICLONE / clonefile, blocks shared, nothing copied
+    CopyFileRange,  // copied inside the kernel (or server side on nfs/smb)
+    Buffered        // read/write through a userspace buffer
+};
+
+IUBPATCH_API const char* copy_method_to_string(CopyMethod method);
+
+// copies src to dst, sharing the data blocks where the filesystem can
+// (FICLONE, clonefile), else in kernel with copy_file_range, else through
+// a buffered copy. first skips the cheaper strategies, mostly for
+// benchmarking, past last it gives up with NotSupported and leaves no dst.
+// dst is replaced and gets src's permissions. returns the strategy that
+// did the copy
+IUBPATCH_API Result<CopyMethod> clone_file(
+    const std::string& src,
+    const std::string& dst,
+    CopyMethod first = CopyMethod::Clone,
+    CopyMethod last = CopyMethod::Buffered
+);
+
+// changes a few bytes of path without rewriting it and without ever
+// leaving it half edited: path is cloned to a temp file, edit writes into
+// that through a writer that keeps the existing contents, then the temp
+// file replaces path. path is untouched if edit fails. last is passed on
+// to clone_file, NotSupported means edit never ran
+IUBPATCH_API Result<void> edit_file_copy(
+    const std::string& path,
+    const std::function<Result<void>(FileWriter&)>& edit,
+    const PatchOptions& options,
+    CopyMethod last = CopyMethod::Buffered
+);
+
+// produces a size byte file at path by letting fill write its contents in
+// place. with mmap allowed by options that is a MappedFileWriter over a
+// temp file renamed onto path once fill succeeds, otherwise a heap buffer
+// handed to write_file. path is left untouched if fill fails
+IUBPATCH_API Result<void> fill_file(
+    const std::string& path,
+    std::size_t size,
+    const std::function<Result<void>(std::span<Byte>)>& fill,
+    const PatchOptions& options
+);
+
 } // namespace iubpatch
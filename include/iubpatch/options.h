@@ -8,13 +8,40 @@ namespace iubpatch {
 // patch options
 struct IUBPATCH_API PatchOptions {
     bool verify_checksums = true;
+    unsigned checksum_threads = 1; // 0 = one per hardware thread
+    unsigned apply_threads = 1; // IPS: big outputs are filled by up to this many threads, 0 = one per hardware thread
     bool validate_src_size = true;
     bool allow_size_mismatch = false;
     bool use_mmap = true;
     std::size_t max_mmap_size = 0;
     std::size_t io_buffer_size = 65536; // 64KB
+    bool access_hints = true; // BPS/IPS: tell mapped sources how the patch is going to read them
+    bool mmap_populate = false; // fault mapped files in up front (MAP_POPULATE)
+    std::size_t mmap_huge_page_size = 0; // >0: transparent huge pages for mappings at least this big
+    bool use_io_uring = false; // Linux builds with IUB_ENABLE_IO_URING: writes outputs, and reads files mmap doesn't take, through io_uring
+    // what file I/O leaves behind in the page cache. DropBehind evicts each
+    // file once it is read or written (posix_fadvise), Direct reads and
+    // writes with O_DIRECT and falls back to DropBehind where the
+    // filesystem refuses it. both read through a buffer instead of mmap
+    enum class CacheMode {
+        Normal,
+        DropBehind,
+        Direct
+    } cache_mode = CacheMode::Normal;
+    std::size_t stream_window_size = 0; // BPS: >0 streams the output to disk keeping only this much in memory
+    // IPS/UPS in place: rewrite only the patched bytes of a copy of the
+    // file. Clone does so only where the copy shares the file's blocks
+    // (reflink), elsewhere copying costs more than rewriting it all.
+    // Always copies whatever the filesystem, Off always rewrites
+    enum class SparseInPlace {
+        Off,
+        Clone,
+        Always
+    } sparse_inplace = SparseInPlace::Clone;
     bool create_backup = false;
     const char* backup_suffix = ".bak";
+    bool use_checksum_cache = false;
+    const char* checksum_cache_path = nullptr; // nullptr = per-user default
 
     PatchOptions() = default;
 };
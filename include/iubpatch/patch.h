@@ -7,6 +7,7 @@
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <span>
 #include <string>
 
 namespace iubpatch {
@@ -40,7 +41,25 @@ public:
     
     virtual Result<PatchMetadata> get_metadata() const = 0;
     
-    virtual Result<Bytes> apply(const Bytes& source, const PatchOptions& options = {}) const = 0;
+    // source can be any contiguous memory (a vector, a mapped file, ...),
+    // it is only read
+    virtual Result<Bytes> apply(std::span<const Byte> source, const PatchOptions& options = {}) const = 0;
+    
+    Result<Bytes> apply(const Bytes& source, const PatchOptions& options = {}) const {
+        return apply(std::span<const Byte>(source), options);
+    }
+    
+    // size of what apply() produces for this source, lets callers allocate
+    // (or map) the output up front
+    virtual Result<std::size_t> output_size(std::span<const Byte> source) const = 0;
+    
+    // apply() into caller memory, target must be exactly output_size(source)
+    // bytes. what target holds after a failure is unspecified
+    virtual Result<void> apply_into(
+        std::span<const Byte> source,
+        std::span<Byte> target,
+        const PatchOptions& options = {}
+    ) const = 0;
     
     virtual Result<void> apply_to_file(
         const std::string& source_path,
@@ -48,6 +67,11 @@ public:
         const PatchOptions& options = {}
     ) const = 0;
     
+    // patches file_path itself, crash safe: the result is built in a temp
+    // file that then replaces it. the default rewrites the whole file,
+    // formats that can instead clone it and write only the bytes that change
+    virtual Result<void> apply_in_place(const std::string& file_path, const PatchOptions& options = {}) const;
+    
     virtual Result<void> validate() const = 0;
     
     virtual const char* format_name() const noexcept = 0;
@@ -56,14 +80,22 @@ protected:
     Patch() = default;
 };
 
-IUBPATCH_API Result<std::unique_ptr<Patch>> load_patch(const std::string& patch_path);
+IUBPATCH_API Result<std::unique_ptr<Patch>> load_patch(const std::string& patch_path, const PatchOptions& options = {});
 
 IUBPATCH_API Result<std::unique_ptr<Patch>> load_patch_from_memory(const Bytes& patch_data);
 
+// no-copy variant, the patch holds owner to keep patch_data valid
+IUBPATCH_API Result<std::unique_ptr<Patch>> load_patch_from_memory(
+    std::span<const Byte> patch_data,
+    std::shared_ptr<const void> owner
+);
+
 IUBPATCH_API Result<Format> detect_format(const std::string& patch_path);
 
 IUBPATCH_API Result<Format> detect_format_from_memory(const Bytes& patch_data);
 
+IUBPATCH_API Result<Format> detect_format_from_memory(std::span<const Byte> patch_data);
+
 IUBPATCH_API const char* format_to_string(Format format) noexcept;
 
 } // namespace iubpatch
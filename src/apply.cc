@@ -2,24 +2,26 @@
 #include "iubpatch/patch.h"
 #include "iubpatch/io.h"
 #include "iubpatch/crc32.h"
+#include "iubpatch/checksum_cache.h"
 #include <filesystem>
 #include <algorithm>
 
 namespace iubpatch {
 
-Result<std::string> create_backup(const std::string& file_path, const PatchOptions& options) {
+Result<std::string> create_backup(const std::string& file_path, const PatchOptions& options, CopyMethod* method) {
     if (!options.create_backup) {
         return ErrorInfo{ErrorCode::InvalidArgument, "Backup not requested"};
     }
     
     std::string backup_path = file_path + options.backup_suffix;
     
-    try {
-        std::filesystem::copy_file(file_path, backup_path, 
-            std::filesystem::copy_options::overwrite_existing);
-    } catch (const std::filesystem::filesystem_error& e) {
+    auto copy_result = clone_file(file_path, backup_path);
+    if (!copy_result) {
         return ErrorInfo{ErrorCode::FileWriteError, 
-            "Failed to create backup: " + std::string(e.what())};
+            "Failed to create backup: " + copy_result.error().message};
+    }
+    if (method) {
+        *method = copy_result.value();
     }
     
     return backup_path;
@@ -45,7 +47,7 @@ Result<void> apply_patch(
     const PatchOptions& options
 ) {
 
-    auto patch_result = load_patch(patch_path);
+    auto patch_result = load_patch(patch_path, options);
     if (!patch_result) {
         return patch_result.error();
     }
@@ -66,21 +68,12 @@ Result<void> apply_patch_inplace(
         }
     }
     
-    std::string temp_path = file_path + ".tmp";
-    auto result = apply_patch(patch_path, file_path, temp_path, options);
-    if (!result) {
-        std::filesystem::remove(temp_path);
-        return result.error();
-    }
-    
-    try {
-        std::filesystem::rename(temp_path, file_path);
-    } catch (const std::filesystem::filesystem_error& e) {
-        return ErrorInfo{ErrorCode::FileWriteError, 
-            "Failed to replace original file: " + std::string(e.what())};
+    auto patch_result = load_patch(patch_path, options);
+    if (!patch_result) {
+        return patch_result.error();
     }
     
-    return Result<void>{};
+    return patch_result.value()->apply_in_place(file_path, options);
 }
 
 Result<void> validate_patch(
@@ -89,7 +82,7 @@ Result<void> validate_patch(
     const PatchOptions& options
 ) {
 
-    auto patch_result = load_patch(patch_path);
+    auto patch_result = load_patch(patch_path, options);
     if (!patch_result) {
         return patch_result.error();
     }
@@ -108,20 +101,24 @@ Result<void> validate_patch(
     const auto& metadata = metadata_result.value();
     
     if (metadata.has_checksums) {
-        auto source_result = read_file(source_path);
-        if (!source_result) {
-            return source_result.error();
+        auto source_id = get_file_identity(source_path);
+        if (!source_id) {
+            return source_id.error();
         }
         
-        const auto& source_data = source_result.value();
-        
-        if (metadata.src_size > 0 && source_data.size() != metadata.src_size) {
+        if (metadata.src_size > 0 && source_id.value().size != metadata.src_size) {
              return ErrorInfo{ErrorCode::SourceSizeMismatch, 
                 "Source size mismatch: expected " + std::to_string(metadata.src_size) + 
-                ", got " + std::to_string(source_data.size())};
+                ", got " + std::to_string(source_id.value().size)};
+        }
+        
+        // served from the checksum cache without reading the file when possible
+        auto crc_result = file_crc32(source_path, options);
+        if (!crc_result) {
+            return crc_result.error();
         }
         
-        auto src_crc = calc_crc32(source_data);
+        auto src_crc = crc_result.value();
         if (src_crc != metadata.source_checksum) {
             return ErrorInfo{ErrorCode::ChecksumMismatch, 
                 "Source CRC32 mismatch: expected " + std::to_string(metadata.source_checksum) + 
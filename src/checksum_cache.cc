@@ -0,0 +1,204 @@
+#include "iubpatch/checksum_cache.h"
+#include "iubpatch/crc32.h"
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <process.h>
+#endif
+
+namespace iubpatch {
+
+namespace {
+
+constexpr const char* CACHE_HEADER = "iubpatch-crc32-cache 1";
+
+// oldest entries are dropped past this, the file stays a few tens of KB
+constexpr std::size_t MAX_CACHE_ENTRIES = 1024;
+
+struct Entry {
+    FileIdentity id;
+    std::uint32_t crc;
+};
+
+std::vector<Entry> load_entries(const std::string& path) {
+    std::vector<Entry> entries;
+    std::ifstream in(path);
+    std::string line;
+    
+    if (!in || !std::getline(in, line) || line != CACHE_HEADER) {
+        return entries;
+    }
+    
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        Entry entry;
+        fields >> entry.id.device >> entry.id.inode >> entry.id.size >> entry.id.mtime_ns
+               >> std::hex >> entry.crc;
+        if (fields) {
+            entries.push_back(entry);
+        }
+    }
+    return entries;
+}
+
+std::string temp_name(const std::string& path) {
+#if defined(_WIN32)
+    auto pid = _getpid();
+#else
+    auto pid = getpid();
+#endif
+    std::ostringstream name;
+    name << path << '.' << pid << '.' << std::hash<std::thread::id>{}(std::this_thread::get_id()) << ".tmp";
+    return name.str();
+}
+
+} // namespace
+
+ChecksumCache::ChecksumCache(std::string path) : path_(std::move(path)) {}
+
+std::string ChecksumCache::path_for(const PatchOptions& options) {
+    if (options.checksum_cache_path && *options.checksum_cache_path) {
+        return options.checksum_cache_path;
+    }
+    
+    std::filesystem::path dir;
+#if defined(_WIN32)
+    if (const char* local = std::getenv("LOCALAPPDATA")) {
+        dir = std::filesystem::path(local) / "iubpatch";
+    }
+#else
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        dir = std::filesystem::path(xdg) / "iubpatch";
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        dir = std::filesystem::path(home) / ".cache" / "iubpatch";
+    }
+#endif
+    if (dir.empty()) {
+        std::error_code ec;
+        dir = std::filesystem::temp_directory_path(ec) / "iubpatch";
+    }
+    return (dir / "crc32.cache").string();
+}
+
+std::optional<std::uint32_t> ChecksumCache::lookup(const FileIdentity& id) const {
+    for (const auto& entry : load_entries(path_)) {
+        if (entry.id == id) {
+            return entry.crc;
+        }
+    }
+    return std::nullopt;
+}
+
+Result<void> ChecksumCache::store(const FileIdentity& id, std::uint32_t crc) const {
+    // merge with whatever other processes wrote since we last looked
+    auto entries = load_entries(path_);
+    std::erase_if(entries, [&](const Entry& entry) {
+        return entry.id.device == id.device && entry.id.inode == id.inode;
+    });
+    entries.push_back({id, crc});
+    if (entries.size() > MAX_CACHE_ENTRIES) {
+        entries.erase(entries.begin(), entries.end() - MAX_CACHE_ENTRIES);
+    }
+    
+    std::error_code ec;
+    auto parent = std::filesystem::path(path_).parent_path();
+    if (!parent.empty()) {
+        std::filesystem::create_directories(parent, ec);
+    }
+    
+    std::string tmp = temp_name(path_);
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) {
+            return ErrorInfo{ErrorCode::FileWriteError, "Cannot write checksum cache: " + tmp};
+        }
+        out << CACHE_HEADER << '\n';
+        for (const auto& entry : entries) {
+            out << entry.id.device << ' ' << entry.id.inode << ' ' << entry.id.size << ' '
+                << entry.id.mtime_ns << ' ' << std::hex << entry.crc << std::dec << '\n';
+        }
+        if (!out.flush()) {
+            out.close();
+            std::filesystem::remove(tmp, ec);
+            return ErrorInfo{ErrorCode::FileWriteError, "Cannot write checksum cache: " + tmp};
+        }
+    }
+    
+    std::filesystem::rename(tmp, path_, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot replace checksum cache: " + path_};
+    }
+    return Result<void>{};
+}
+
+Result<std::uint32_t> file_crc32(const std::string& path, const PatchOptions& options) {
+    auto before = get_file_identity(path);
+    if (!before) {
+        return before.error();
+    }
+    
+    std::optional<ChecksumCache> cache;
+    if (options.use_checksum_cache) {
+        cache.emplace(ChecksumCache::path_for(options));
+        if (auto crc = cache->lookup(before.value())) {
+            return *crc;
+        }
+    }
+    
+    auto reader_result = open_file_reader(path, options);
+    if (!reader_result) {
+        return reader_result.error();
+    }
+    auto& reader = reader_result.value();
+    auto size_result = reader->size();
+    if (!size_result) {
+        return size_result.error();
+    }
+    auto view = reader->read_view(0, size_result.value());
+    if (!view) {
+        return view.error();
+    }
+    std::uint32_t crc = calc_crc32_parallel(view.value(), options.checksum_threads);
+    
+    // only remember it if nothing touched the file while we were reading,
+    // failing to write the cache is not worth failing the caller over
+    if (cache) {
+        auto after = get_file_identity(path);
+        if (after && after.value() == before.value()) {
+            static_cast<void>(cache->store(before.value(), crc));
+        }
+    }
+    return crc;
+}
+
+std::optional<std::uint32_t> cached_file_crc32(const std::string& path, const PatchOptions& options) {
+    if (!options.verify_checksums || !options.use_checksum_cache) {
+        return std::nullopt;
+    }
+    auto id_result = get_file_identity(path);
+    if (!id_result) {
+        return std::nullopt;
+    }
+    return ChecksumCache(ChecksumCache::path_for(options)).lookup(id_result.value());
+}
+
+void store_file_crc32(const std::string& path, const FileIdentity& before, std::uint32_t crc, const PatchOptions& options) {
+    if (!options.verify_checksums || !options.use_checksum_cache) {
+        return;
+    }
+    auto after = get_file_identity(path);
+    if (after && after.value() == before) {
+        static_cast<void>(ChecksumCache(ChecksumCache::path_for(options)).store(before, crc));
+    }
+}
+
+} // namespace iubpatch
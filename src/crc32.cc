@@ -0,0 +1,290 @@
+#include "iubpatch/crc32.h"
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IUB_CRC32_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#define IUB_CRC32_ARM 1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define IUB_TARGET(x) __attribute__((target(x)))
+#else
+#define IUB_TARGET(x)
+#endif
+
+namespace iubpatch {
+
+namespace {
+
+using UpdateFn = std::uint32_t (*)(std::uint32_t, std::span<const std::uint8_t>);
+
+struct Backend {
+    UpdateFn update;
+    const char* name;
+};
+
+#ifdef IUB_CRC32_X86
+
+// carry-less multiply folding for the reflected IEEE polynomial, same
+// constants as the linux crc32-pclmul and zlib folding code
+// k1/k2: fold 4x128 bits forward by 512 bits
+// k3/k4: fold 128 bits forward by 128 bits
+// k5: 64 -> 32 bit fold, poly/mu: barrett reduction
+IUB_TARGET("pclmul,sse4.1")
+inline __m128i load(const std::uint8_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+IUB_TARGET("pclmul,sse4.1")
+inline __m128i fold(__m128i x, __m128i k, __m128i next) {
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+IUB_TARGET("pclmul,sse4.1")
+std::uint32_t crc32_update_pclmul(std::uint32_t crc, std::span<const std::uint8_t> data) {
+    const std::uint8_t* p = data.data();
+    std::size_t n = data.size();
+
+    if (n < 64) {
+        return crc32_update_slice16(crc, data);
+    }
+
+    __m128i x1 = _mm_xor_si128(load(p), _mm_cvtsi32_si128(static_cast<int>(crc)));
+    __m128i x2 = load(p + 16);
+    __m128i x3 = load(p + 32);
+    __m128i x4 = load(p + 48);
+    p += 64;
+    n -= 64;
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    while (n >= 64) {
+        x1 = fold(x1, k1k2, load(p));
+        x2 = fold(x2, k1k2, load(p + 16));
+        x3 = fold(x3, k1k2, load(p + 32));
+        x4 = fold(x4, k1k2, load(p + 48));
+        p += 64;
+        n -= 64;
+    }
+
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    x1 = fold(x1, k3k4, x2);
+    x1 = fold(x1, k3k4, x3);
+    x1 = fold(x1, k3k4, x4);
+
+    while (n >= 16) {
+        x1 = fold(x1, k3k4, load(p));
+        p += 16;
+        n -= 16;
+    }
+
+    // 128 -> 64 bits
+    __m128i t = _mm_clmulepi64_si128(k3k4, x1, 0x01);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+
+    // 64 -> 32 bits
+    const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+    t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 4), t);
+
+    // barrett reduction
+    const __m128i poly_mu = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly_mu, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly_mu, 0x00);
+    x1 = _mm_xor_si128(x1, t);
+
+    crc = static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+    return crc32_update_slice16(crc, {p, n});
+}
+
+bool cpu_has_pclmul() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+    __cpuid(regs, 1);
+    bool pclmul = (regs[2] & (1 << 1)) != 0;
+    bool sse41 = (regs[2] & (1 << 19)) != 0;
+    return pclmul && sse41;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+#endif // IUB_CRC32_X86
+
+#ifdef IUB_CRC32_ARM
+
+// the ARMv8 CRC32 instructions implement the same IEEE polynomial, so a
+// single crc32x per 8 bytes beats table lookups without needing folding
+IUB_TARGET("+crc")
+std::uint32_t crc32_update_armv8(std::uint32_t crc, std::span<const std::uint8_t> data) {
+    const std::uint8_t* p = data.data();
+    std::size_t n = data.size();
+
+    while (n >= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = __crc32d(crc, word);
+        p += 8;
+        n -= 8;
+    }
+    while (n--) {
+        crc = __crc32b(crc, *p++);
+    }
+    return crc;
+}
+
+bool cpu_has_crc32() {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#endif // IUB_CRC32_ARM
+
+Backend select_backend() {
+#ifdef IUB_CRC32_X86
+    if (cpu_has_pclmul()) {
+        return {crc32_update_pclmul, "pclmul"};
+    }
+#endif
+#ifdef IUB_CRC32_ARM
+    if (cpu_has_crc32()) {
+        return {crc32_update_armv8, "armv8-crc32"};
+    }
+#endif
+    return {crc32_update_slice16, "slice16"};
+}
+
+const Backend& backend() {
+    static const Backend selected = select_backend();
+    return selected;
+}
+
+// polynomial arithmetic mod P for crc32_combine, same approach as zlib:
+// appending n zero bytes multiplies the crc register by x^(8n) mod P
+constexpr std::uint32_t multmodp(std::uint32_t a, std::uint32_t b) {
+    std::uint32_t m = 1u << 31;
+    std::uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ detail::crc32_poly : b >> 1;
+    }
+    return p;
+}
+
+// x2n_table[k] = x^(2^k) mod P
+constexpr std::array<std::uint32_t, 32> make_x2n_table() {
+    std::array<std::uint32_t, 32> table{};
+    std::uint32_t p = 1u << 30; // x^1
+    table[0] = p;
+    for (std::size_t n = 1; n < 32; ++n) {
+        table[n] = p = multmodp(p, p);
+    }
+    return table;
+}
+
+constexpr auto x2n_table = make_x2n_table();
+
+// x^(n * 2^k) mod P
+std::uint32_t x2nmodp(std::uint64_t n, unsigned k) {
+    std::uint32_t p = 1u << 31; // x^0
+    while (n) {
+        if (n & 1) {
+            p = multmodp(x2n_table[k & 31], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+} // namespace
+
+std::uint32_t crc32_combine(std::uint32_t crc_a, std::uint32_t crc_b, std::uint64_t len_b) {
+    return multmodp(x2nmodp(len_b, 3), crc_a) ^ crc_b;
+}
+
+std::uint32_t calc_crc32_parallel(std::span<const std::uint8_t> data, unsigned threads) {
+    // below this per-thread share, spawning costs more than it saves
+    constexpr std::size_t min_chunk_size = 1 << 20;
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::size_t count = std::min<std::size_t>(threads, data.size() / min_chunk_size);
+    if (count <= 1) {
+        return calc_crc32(data);
+    }
+
+    std::size_t chunk_size = data.size() / count;
+    std::vector<std::uint32_t> partial(count);
+    std::vector<std::thread> workers;
+    workers.reserve(count - 1);
+
+    auto chunk = [&](std::size_t i) {
+        std::size_t begin = i * chunk_size;
+        std::size_t length = (i + 1 == count) ? data.size() - begin : chunk_size;
+        return data.subspan(begin, length);
+    };
+
+    for (std::size_t i = 1; i < count; ++i) {
+        try {
+            workers.emplace_back([&partial, &chunk, i] {
+                partial[i] = calc_crc32(chunk(i));
+            });
+        } catch (const std::system_error&) {
+            // out of threads, hash it here instead
+            partial[i] = calc_crc32(chunk(i));
+        }
+    }
+    partial[0] = calc_crc32(chunk(0));
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::uint32_t crc = partial[0];
+    for (std::size_t i = 1; i < count; ++i) {
+        crc = crc32_combine(crc, partial[i], chunk(i).size());
+    }
+    return crc;
+}
+
+std::future<std::uint32_t> calc_crc32_async(std::span<const std::uint8_t> data, unsigned threads) {
+    try {
+        return std::async(std::launch::async, calc_crc32_parallel, data, threads);
+    } catch (const std::system_error&) {
+        // no thread to spare, hash when the result is asked for
+        return std::async(std::launch::deferred, calc_crc32_parallel, data, threads);
+    }
+}
+
+std::uint32_t crc32_update(std::uint32_t crc, std::span<const std::uint8_t> data) {
+    return backend().update(crc, data);
+}
+
+const char* crc32_backend_name() noexcept {
+    return backend().name;
+}
+
+} // namespace iubpatch
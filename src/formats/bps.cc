@@ -1,9 +1,14 @@
 #include "iubpatch/formats/bps.h"
 #include "iubpatch/io.h"
 #include "iubpatch/crc32.h"
+#include "iubpatch/checksum_cache.h"
+#include "patch_file.h"
+#include "varint.h"
 #include <cstdint>
 #include <cstring>
 #include <algorithm>
+#include <optional>
+#include <filesystem>
 
 namespace iubpatch {
 
@@ -11,24 +16,84 @@ namespace iubpatch {
 static constexpr char BPS_MAGIC[] = "BPS1";
 static constexpr std::size_t BPS_HEADER_SIZE = 4;
 
-static std::uint64_t decode_bps_num(const Bytes& data, std::size_t& offset) {
-    std::uint64_t value = 0;
-    std::uint64_t shift = 1;
-    
-    while (offset < data.size()) {
-        std::uint64_t byte = data[offset++];
-        value += (byte & 0x7F) * shift;
-        if (byte & 0x80) break;
-        shift <<= 7;
-        value += shift;
+// the last few bytes of a streamed target. output goes to the writer in
+// batches, anything older than the ring is read back from the writer
+class TargetWindow {
+public:
+    TargetWindow(FileWriter& writer, std::size_t size, Crc32* crc)
+        : writer_(writer), ring_(std::max<std::size_t>(size, 1)), crc_(crc) {}
+    
+    std::size_t produced() const noexcept { return produced_; }
+    
+    // how much can be put() before the ring has to be flushed
+    std::size_t room() const noexcept { return ring_.size() - (produced_ - written_); }
+    
+    Result<void> flush() {
+        while (written_ < produced_) {
+            std::size_t at = written_ % ring_.size();
+            std::size_t n = std::min(produced_ - written_, ring_.size() - at);
+            auto result = writer_.write({ring_.data() + at, n});
+            if (!result) {
+                return result;
+            }
+            written_ += n;
+        }
+        return Result<void>{};
     }
     
-    return value;
-}
+    // n must fit in room()
+    void put(const Byte* data, std::size_t n) {
+        while (n > 0) {
+            std::size_t at = produced_ % ring_.size();
+            std::size_t chunk = std::min(n, ring_.size() - at);
+            std::memcpy(&ring_[at], data, chunk);
+            if (crc_) {
+                crc_->update({&ring_[at], chunk});
+            }
+            produced_ += chunk;
+            data += chunk;
+            n -= chunk;
+        }
+    }
+    
+    // copies already produced output [pos, pos + n) into out
+    Result<void> get(std::size_t pos, Byte* out, std::size_t n) {
+        std::size_t ring_start = produced_ - std::min(produced_, ring_.size());
+        if (pos < ring_start) {
+            // everything before the ring has been written out already
+            std::size_t from_file = std::min(n, ring_start - pos);
+            auto result = writer_.read_at(pos, {out, from_file});
+            if (!result) {
+                return result;
+            }
+            pos += from_file;
+            out += from_file;
+            n -= from_file;
+        }
+        while (n > 0) {
+            std::size_t at = pos % ring_.size();
+            std::size_t chunk = std::min(n, ring_.size() - at);
+            std::memcpy(out, &ring_[at], chunk);
+            pos += chunk;
+            out += chunk;
+            n -= chunk;
+        }
+        return Result<void>{};
+    }
+    
+private:
+    FileWriter& writer_;
+    Bytes ring_;
+    Crc32* crc_;
+    std::size_t produced_ = 0;
+    std::size_t written_ = 0;
+};
 
 class BPSPatch::Impl {
 public:
-    Bytes patch_data;
+    // view of the patch bytes, owner keeps whatever backs them alive
+    std::span<const Byte> patch_data;
+    std::shared_ptr<const void> owner;
     std::size_t src_size = 0;
     std::size_t target_size = 0;
     std::size_t metadata_size = 0;
@@ -42,13 +107,488 @@ public:
     struct Command {
         Action action;
         std::uint64_t length;
-        std::uint64_t offset_delta;
+        std::uint64_t offset_delta; // TargetRead: offset of the payload in patch_data
     };
     
-    std::vector<Command> commands;
+    // where the command stream starts in patch_data, it runs up to the
+    // 12 checksum bytes at the end
     std::size_t data_offset = 0;
     
-    Result<void> parse() {
+    // base moved by a zigzag encoded delta. done unsigned so a hostile
+    // delta wraps instead of overflowing, anything that ends up past 2^63
+    // comes back negative and fails the caller's bounds check
+    static std::int64_t apply_delta(std::size_t base, std::uint64_t delta) {
+        std::uint64_t magnitude = delta >> 1;
+        std::uint64_t moved = (delta & 1) ? std::uint64_t{base} - magnitude : std::uint64_t{base} + magnitude;
+        return static_cast<std::int64_t>(moved);
+    }
+    
+    // decodes the command stream straight out of patch_data while the
+    // engine runs it, nothing is decoded ahead of time or kept around
+    class CommandCursor {
+    public:
+        explicit CommandCursor(const Impl& impl)
+            : data_(impl.patch_data.first(impl.patch_data.size() - 12)), offset_(impl.data_offset) {}
+        
+        bool done() const noexcept { return offset_ >= data_.size(); }
+        
+        Result<void> next(Command& cmd) {
+            std::uint64_t encoded = 0;
+            auto status = detail::read_varint(data_, offset_, encoded);
+            if (status != detail::VarintStatus::Ok) {
+                return detail::varint_error(status);
+            }
+            cmd.action = static_cast<Action>(encoded & 3);
+            cmd.length = (encoded >> 2) + 1;
+            
+            if (cmd.action == Action::SourceCopy || cmd.action == Action::TargetCopy) {
+                status = detail::read_varint(data_, offset_, cmd.offset_delta);
+                if (status != detail::VarintStatus::Ok) {
+                    return detail::varint_error(status);
+                }
+            } else if (cmd.action == Action::TargetRead) {
+                // the payload follows the command inline
+                if (cmd.length > data_.size() - offset_) {
+                    return ErrorInfo{ErrorCode::InvalidPatchFormat, "TargetRead exceeds patch data"};
+                }
+                cmd.offset_delta = offset_;
+                offset_ += cmd.length;
+            } else {
+                cmd.offset_delta = 0;
+            }
+            return Result<void>{};
+        }
+        
+    private:
+        std::span<const Byte> data_; // the command stream, without the checksums
+        std::size_t offset_;
+    };
+    
+    // how many commands ahead of the engine source ranges get requested
+    static constexpr std::size_t PREFETCH_DISTANCE = 16;
+    // smaller sources are read in by the kernel's own readahead soon enough
+    static constexpr std::size_t PREFETCH_MIN_SOURCE = 1 << 20;
+    
+    // runs a few commands ahead of the engine and asks the source reader
+    // to start loading what they are going to copy. readahead only follows
+    // sequential reads, so on a cold cache every SourceCopy that jumps
+    // elsewhere would otherwise stall on a page fault
+    class SourcePrefetch {
+    public:
+        SourcePrefetch(const Impl& impl, FileReader* reader, std::size_t source_size)
+            : ahead_(impl), reader_(source_size >= PREFETCH_MIN_SOURCE ? reader : nullptr) {
+            if (!reader_) {
+                return;
+            }
+            
+            // one extra decoding pass, only paid for big mapped sources
+            std::size_t copies = 0;
+            std::size_t jumps = 0;
+            std::size_t spread = 0; // roughly how much of the source the jumps land in
+            std::size_t rel_offset = 0;
+            CommandCursor scan(impl);
+            Command cmd;
+            while (!scan.done() && scan.next(cmd)) {
+                if (cmd.action == Action::SourceCopy) {
+                    ++copies;
+                    std::int64_t offset = apply_delta(rel_offset, cmd.offset_delta);
+                    if (static_cast<std::size_t>(offset) != rel_offset) {
+                        ++jumps;
+                        spread += cmd.length + 4096;
+                    }
+                    rel_offset = offset + cmd.length;
+                }
+            }
+            
+            // few jumps, or jumps covering much of the source: readahead
+            // pulling in whole runs of it beats asking page by page, so the
+            // mapping keeps its Sequential advice
+            if (jumps < 64 || spread > source_size / 4) {
+                reader_ = nullptr;
+                return;
+            }
+            
+            // mostly jumps: readahead only wastes I/O, so turn it off and
+            // request every source range instead
+            if (jumps * 2 > copies) {
+                every_read_ = true;
+                reader_->advise(0, source_size, AccessHint::Random);
+            } else {
+                reader_->advise(0, source_size, AccessHint::Normal);
+            }
+        }
+        
+        // call before running each command
+        void next() {
+            if (!reader_) {
+                return;
+            }
+            // a malformed command ends the lookahead, the engine reports it
+            Command cmd;
+            for (++started_; looked_ < started_ + PREFETCH_DISTANCE && !ahead_.done(); ++looked_) {
+                if (!ahead_.next(cmd)) {
+                    reader_ = nullptr;
+                    return;
+                }
+                look(cmd);
+            }
+        }
+        
+    private:
+        void look(const Command& cmd) {
+            switch (cmd.action) {
+                case Action::SourceRead:
+                    if (every_read_) {
+                        request(target_pos_, cmd.length);
+                    }
+                    break;
+                case Action::SourceCopy: {
+                    // a bad offset is the engine's to report
+                    std::int64_t offset = apply_delta(source_rel_offset_, cmd.offset_delta);
+                    if (offset < 0) {
+                        return;
+                    }
+                    if (every_read_ || static_cast<std::size_t>(offset) != source_rel_offset_) {
+                        request(offset, cmd.length);
+                    }
+                    source_rel_offset_ = offset + cmd.length;
+                    break;
+                }
+                default:
+                    break;
+            }
+            target_pos_ += cmd.length;
+        }
+        
+        void request(std::size_t offset, std::size_t length) {
+            if (offset >= requested_from_ && offset + length <= requested_to_) {
+                return;
+            }
+            reader_->advise(offset, length, AccessHint::WillNeed);
+            requested_from_ = offset;
+            requested_to_ = offset + length;
+        }
+        
+        CommandCursor ahead_;
+        FileReader* reader_;
+        bool every_read_ = false;
+        std::size_t started_ = 0;
+        std::size_t looked_ = 0;
+        std::size_t source_rel_offset_ = 0;
+        std::size_t target_pos_ = 0;
+        std::size_t requested_from_ = 0;
+        std::size_t requested_to_ = 0;
+    };
+    
+    // runs the command stream into target, feeding the produced bytes to
+    // output_crc (if given) every few KB while they are still in cache.
+    // returns how many bytes were produced. source_reader (if given) is the
+    // reader behind source and gets access hints
+    //
+    // each command is checked against the source, the patch and what is
+    // left of target once, after that it is a plain memcpy
+    Result<std::size_t> execute(std::span<const Byte> source, std::span<Byte> target, Crc32* output_crc,
+                                FileReader* source_reader) const {
+        const Byte* const src = source.data();
+        const Byte* const payload = patch_data.data();
+        Byte* const out = target.data();
+        std::size_t source_rel_offset = 0;
+        std::size_t target_rel_offset = 0;
+        std::size_t produced = 0;
+        std::size_t hashed = 0;
+        SourcePrefetch prefetch(*this, source_reader, source.size());
+        
+        CommandCursor cursor(*this);
+        Command cmd;
+        while (!cursor.done()) {
+            auto decoded = cursor.next(cmd);
+            if (!decoded) {
+                return decoded.error();
+            }
+            prefetch.next();
+            if (cmd.length > target.size() - produced) {
+                return ErrorInfo{ErrorCode::InvalidPatchFormat, "Command exceeds target size"};
+            }
+            std::size_t length = static_cast<std::size_t>(cmd.length);
+            
+            switch (cmd.action) {
+                case Action::SourceRead: {
+                    // copies the source bytes at the same position as the output
+                    if (produced > source.size() || length > source.size() - produced) {
+                        return ErrorInfo{ErrorCode::InvalidPatchFormat, "SourceRead exceeds source size"};
+                    }
+                    std::memcpy(out + produced, src + produced, length);
+                    break;
+                }
+                
+                case Action::TargetRead: {
+                    // the cursor already checked the payload is in the patch
+                    std::memcpy(out + produced, payload + cmd.offset_delta, length);
+                    break;
+                }
+                
+                case Action::SourceCopy: {
+                    std::int64_t offset = apply_delta(source_rel_offset, cmd.offset_delta);
+                    if (offset < 0 || static_cast<std::size_t>(offset) > source.size() ||
+                        length > source.size() - static_cast<std::size_t>(offset)) {
+                        return ErrorInfo{ErrorCode::InvalidPatchFormat, "SourceCopy offset out of bounds"};
+                    }
+                    std::memcpy(out + produced, src + offset, length);
+                    source_rel_offset = offset + length;
+                    break;
+                }
+                
+                case Action::TargetCopy: {
+                    std::int64_t offset = apply_delta(target_rel_offset, cmd.offset_delta);
+                    if (offset < 0 || static_cast<std::size_t>(offset) >= produced) {
+                        return ErrorInfo{ErrorCode::InvalidPatchFormat, "TargetCopy offset out of bounds"};
+                    }
+                    
+                    // a copy that overlaps what it writes repeats the last
+                    // distance bytes. every pass copies all of the output
+                    // from offset on, so the pattern doubles each time and
+                    // the passes never overlap themselves. a few bytes are
+                    // quicker to copy one by one than through memcpy
+                    std::size_t from = offset;
+                    std::size_t distance = produced - from;
+                    std::size_t done = 0;
+                    if (length < 16) {
+                        for (; done < length; ++done) {
+                            out[produced + done] = out[from + done];
+                        }
+                    }
+                    while (done < length) {
+                        std::size_t chunk = std::min(length - done, distance + done);
+                        std::memcpy(out + produced + done, out + from, chunk);
+                        done += chunk;
+                    }
+                    target_rel_offset = offset + length;
+                    break;
+                }
+            }
+            produced += length;
+            
+            if (output_crc && produced - hashed >= 16384) {
+                output_crc->update({out + hashed, produced - hashed});
+                hashed = produced;
+            }
+        }
+        
+        if (output_crc) {
+            output_crc->update({out + hashed, produced - hashed});
+        }
+        return produced;
+    }
+    
+    // execute() for a target that doesn't fit in memory: the output goes
+    // through window to its writer, same checks as execute()
+    Result<std::size_t> stream(std::span<const Byte> source, TargetWindow& window, FileReader* source_reader) const {
+        std::size_t source_rel_offset = 0;
+        std::size_t target_rel_offset = 0;
+        SourcePrefetch prefetch(*this, source_reader, source.size());
+        
+        // feeds n bytes starting at data into the window, flushing as needed
+        auto emit = [&window](const Byte* data, std::size_t n) -> Result<void> {
+            while (n > 0) {
+                if (window.room() == 0) {
+                    auto result = window.flush();
+                    if (!result) {
+                        return result;
+                    }
+                }
+                std::size_t chunk = std::min(n, window.room());
+                window.put(data, chunk);
+                data += chunk;
+                n -= chunk;
+            }
+            return Result<void>{};
+        };
+        
+        Bytes scratch;
+        CommandCursor cursor(*this);
+        Command cmd;
+        while (!cursor.done()) {
+            auto decoded = cursor.next(cmd);
+            if (!decoded) {
+                return decoded.error();
+            }
+            prefetch.next();
+            std::size_t produced = window.produced();
+            if (cmd.length > target_size - produced) {
+                return ErrorInfo{ErrorCode::InvalidPatchFormat, "Command exceeds target size"};
+            }
+            
+            Result<void> result;
+            switch (cmd.action) {
+                case Action::SourceRead: {
+                    if (produced + cmd.length > source.size()) {
+                        return ErrorInfo{ErrorCode::InvalidPatchFormat, "SourceRead exceeds source size"};
+                    }
+                    result = emit(source.data() + produced, cmd.length);
+                    break;
+                }
+                
+                case Action::TargetRead: {
+                    result = emit(patch_data.data() + cmd.offset_delta, cmd.length);
+                    break;
+                }
+                
+                case Action::SourceCopy: {
+                    std::int64_t offset = apply_delta(source_rel_offset, cmd.offset_delta);
+                    if (offset < 0 || static_cast<std::size_t>(offset) + cmd.length > source.size()) {
+                        return ErrorInfo{ErrorCode::InvalidPatchFormat, "SourceCopy offset out of bounds"};
+                    }
+                    result = emit(source.data() + offset, cmd.length);
+                    source_rel_offset = offset + cmd.length;
+                    break;
+                }
+                
+                case Action::TargetCopy: {
+                    std::int64_t offset = apply_delta(target_rel_offset, cmd.offset_delta);
+                    if (offset < 0 || static_cast<std::size_t>(offset) >= produced) {
+                        return ErrorInfo{ErrorCode::InvalidPatchFormat, "TargetCopy offset out of bounds"};
+                    }
+                    
+                    std::size_t from = offset;
+                    std::size_t distance = produced - from;
+                    std::uint64_t remaining = cmd.length;
+                    if (distance < cmd.length && distance <= 65536) {
+                        // overlapping, the last distance bytes repeat. fill
+                        // scratch with as many whole periods as fit and emit
+                        // that over and over, it stays in phase
+                        std::size_t span = std::min<std::uint64_t>(cmd.length, 65536 / distance * distance);
+                        scratch.resize(span);
+                        result = window.get(from, scratch.data(), distance);
+                        for (std::size_t have = distance; have < span; have *= 2) {
+                            std::memcpy(scratch.data() + have, scratch.data(), std::min(have, span - have));
+                        }
+                        while (remaining > 0 && result) {
+                            std::size_t chunk = std::min<std::uint64_t>(remaining, span);
+                            result = emit(scratch.data(), chunk);
+                            remaining -= chunk;
+                        }
+                    }
+                    
+                    // never read further than what is already produced, a
+                    // far overlapping copy picks up its own output a step later
+                    while (remaining > 0 && result) {
+                        std::size_t chunk = std::min<std::uint64_t>({remaining, window.produced() - from, 65536});
+                        scratch.resize(chunk);
+                        result = window.get(from, scratch.data(), chunk);
+                        if (result) {
+                            result = emit(scratch.data(), chunk);
+                        }
+                        from += chunk;
+                        remaining -= chunk;
+                    }
+                    target_rel_offset = offset + cmd.length;
+                    break;
+                }
+            }
+            if (!result) {
+                return result.error();
+            }
+        }
+        
+        auto flush_result = window.flush();
+        if (!flush_result) {
+            return flush_result.error();
+        }
+        return window.produced();
+    }
+    
+    // source size and checksum checks around run, which produces the target
+    // feeding output_crc (if given) and returns how many bytes it produced.
+    // known_src_crc: the source checksum is already known (checksum cache),
+    // use it instead of hashing the source
+    template <typename Run>
+    Result<void> checked_run(std::span<const Byte> source, const PatchOptions& options,
+                             std::optional<std::uint32_t> known_src_crc, Run&& run) const {
+        
+        if (source.size() != src_size) {
+            return ErrorInfo{ErrorCode::SourceSizeMismatch, 
+                "Source size mismatch: expected " + std::to_string(src_size) +
+                ", got " + std::to_string(source.size())};
+        }
+        
+        auto source_crc_error = [this](std::uint32_t actual_src_crc) -> Result<void> {
+            if (actual_src_crc != src_crc) {
+                return ErrorInfo{ErrorCode::ChecksumMismatch, 
+                    "Source CRC32 mismatch: expected " + std::to_string(src_crc) +
+                    ", got " + std::to_string(actual_src_crc)};
+            }
+            return Result<void>{};
+        };
+        
+        // with threads to spare the source hash runs alongside the commands,
+        // otherwise it is checked up front before any work is done
+        std::future<std::uint32_t> pending_src_crc;
+        if (options.verify_checksums) {
+            if (!known_src_crc && options.checksum_threads != 1) {
+                pending_src_crc = calc_crc32_async(source, options.checksum_threads);
+            } else {
+                auto check = source_crc_error(known_src_crc ? *known_src_crc : calc_crc32(source));
+                if (!check) {
+                    return check;
+                }
+            }
+        }
+        
+        // target crc is accumulated as each command produces its bytes
+        Crc32 output_crc;
+        auto run_result = run(options.verify_checksums ? &output_crc : nullptr);
+        
+        if (pending_src_crc.valid()) {
+            // a bad source explains a bad command stream, so report it first
+            auto check = source_crc_error(pending_src_crc.get());
+            if (!check) {
+                return check;
+            }
+        }
+        
+        if (!run_result) {
+            return run_result.error();
+        }
+        
+        if (run_result.value() != target_size) {
+            return ErrorInfo{ErrorCode::InvalidPatchFormat,
+                "Output size mismatch: expected " + std::to_string(target_size) +
+                ", got " + std::to_string(run_result.value())};
+        }
+        
+        if (options.verify_checksums) {
+            std::uint32_t actual_target_crc = output_crc.finalize();
+            if (actual_target_crc != target_crc) {
+                return ErrorInfo{ErrorCode::ChecksumMismatch,
+                    "Target CRC32 mismatch: expected " + std::to_string(target_crc) +
+                    ", got " + std::to_string(actual_target_crc)};
+            }
+        }
+        
+        return Result<void>{};
+    }
+    
+    Result<void> apply_into(std::span<const Byte> source, std::span<Byte> target, const PatchOptions& options,
+                            std::optional<std::uint32_t> known_src_crc, FileReader* source_reader = nullptr) const {
+        if (target.size() != target_size) {
+            return ErrorInfo{ErrorCode::InvalidArgument,
+                "Target buffer is " + std::to_string(target.size()) +
+                " bytes, patch produces " + std::to_string(target_size)};
+        }
+        return checked_run(source, options, known_src_crc, [&](Crc32* output_crc) {
+            return execute(source, target, output_crc, source_reader);
+        });
+    }
+    
+    Result<void> apply_streaming(std::span<const Byte> source, FileWriter& writer, const PatchOptions& options,
+                                 std::optional<std::uint32_t> known_src_crc, FileReader* source_reader = nullptr) const {
+        return checked_run(source, options, known_src_crc, [&](Crc32* output_crc) {
+            TargetWindow window(writer, options.stream_window_size, output_crc);
+            return stream(source, window, source_reader);
+        });
+    }
+    
+    Result<void> parse(bool verify_patch_crc) {
         if (patch_data.size() < BPS_HEADER_SIZE + 12) {
             return ErrorInfo{ErrorCode::InvalidPatchFormat, "BPS patch too small"};
         }
@@ -59,12 +599,21 @@ public:
         
         std::size_t offset = BPS_HEADER_SIZE;
         
-        src_size = decode_bps_num(patch_data, offset);
-        target_size = decode_bps_num(patch_data, offset);
-        metadata_size = decode_bps_num(patch_data, offset);
+        // the header numbers can't run into the checksums either
+        auto header = patch_data.first(patch_data.size() - 12);
+        for (std::size_t* field : {&src_size, &target_size, &metadata_size}) {
+            auto value = detail::decode_varint(header, offset);
+            if (!value) {
+                return value.error();
+            }
+            if (value.value() > SIZE_MAX) {
+                return ErrorInfo{ErrorCode::PatchTooLarge, "BPS header size does not fit in memory"};
+            }
+            *field = static_cast<std::size_t>(value.value());
+        }
         
         if (metadata_size > 0) {
-            if (offset + metadata_size > patch_data.size()) {
+            if (metadata_size > header.size() - offset) {
                 return ErrorInfo{ErrorCode::InvalidPatchFormat, "Metadata exceeds patch size"};
             }
             metadata_string.assign(
@@ -74,34 +623,23 @@ public:
             offset += metadata_size;
         }
         
+        // the commands are decoded when the patch is applied
         data_offset = offset;
         
-        // parse until last 12 bytes
-        while (offset + 12 < patch_data.size()) {
-            std::uint64_t encoded = decode_bps_num(patch_data, offset);
-            
-            Command cmd;
-            cmd.action = static_cast<Action>(encoded & 3);
-            cmd.length = (encoded >> 2) + 1;
-            
-            if (cmd.action == Action::SourceCopy || cmd.action == Action::TargetCopy) {
-                cmd.offset_delta = decode_bps_num(patch_data, offset);
-            } else {
-                cmd.offset_delta = 0;
-            }
-            
-            commands.push_back(cmd);
-        }
-        
-        if (patch_data.size() < 12) {
-            return ErrorInfo{ErrorCode::InvalidPatchFormat, "Missing checksums"};
-        }
-        
         std::size_t crc_offset = patch_data.size() - 12;
         std::memcpy(&src_crc, &patch_data[crc_offset], 4);
         std::memcpy(&target_crc, &patch_data[crc_offset + 4], 4);
         std::memcpy(&patch_crc, &patch_data[crc_offset + 8], 4);
         
+        if (verify_patch_crc) {
+            std::uint32_t actual_patch_crc = calc_crc32(patch_data.first(patch_data.size() - 4));
+            if (actual_patch_crc != patch_crc) {
+                return ErrorInfo{ErrorCode::ChecksumMismatch,
+                    "Patch CRC32 mismatch: expected " + std::to_string(patch_crc) +
+                    ", got " + std::to_string(actual_patch_crc)};
+            }
+        }
+        
         return Result<void>{};
     }
 };
@@ -109,7 +647,7 @@ public:
 BPSPatch::BPSPatch() : impl_(std::make_unique<Impl>()) {}
 BPSPatch::~BPSPatch() = default;
 
-Result<std::unique_ptr<BPSPatch>> BPSPatch::load(const Bytes& patch_data) {
+Result<std::unique_ptr<BPSPatch>> BPSPatch::load(std::span<const Byte> patch_data, std::shared_ptr<const void> owner, bool verify_patch_crc) {
     if (patch_data.size() < BPS_HEADER_SIZE + 12) {
         return ErrorInfo{ErrorCode::InvalidPatchFormat, "BPS patch too small"};
     }
@@ -120,8 +658,9 @@ Result<std::unique_ptr<BPSPatch>> BPSPatch::load(const Bytes& patch_data) {
     
     auto patch = std::unique_ptr<BPSPatch>(new BPSPatch());
     patch->impl_->patch_data = patch_data;
+    patch->impl_->owner = std::move(owner);
     
-    auto parse_result = patch->impl_->parse();
+    auto parse_result = patch->impl_->parse(verify_patch_crc);
     if (!parse_result.is_ok()) {
         return parse_result.error();
     }
@@ -129,12 +668,17 @@ Result<std::unique_ptr<BPSPatch>> BPSPatch::load(const Bytes& patch_data) {
     return patch;
 }
 
-Result<std::unique_ptr<BPSPatch>> BPSPatch::load_from_file(const std::string& path) {
-    auto data_result = read_file(path);
-    if (!data_result) {
-        return data_result.error();
+Result<std::unique_ptr<BPSPatch>> BPSPatch::load(const Bytes& patch_data, bool verify_patch_crc) {
+    auto owned = std::make_shared<const Bytes>(patch_data);
+    return load(std::span<const Byte>(*owned), owned, verify_patch_crc);
+}
+
+Result<std::unique_ptr<BPSPatch>> BPSPatch::load_from_file(const std::string& path, const PatchOptions& options) {
+    auto file = detail::open_patch_file(path, options);
+    if (!file) {
+        return file.error();
     }
-    return load(data_result.value());
+    return load(file.value().data, std::move(file.value().owner));
 }
 
 Result<PatchMetadata> BPSPatch::get_metadata() const {
@@ -149,123 +693,108 @@ Result<PatchMetadata> BPSPatch::get_metadata() const {
     return metadata;
 }
 
-Result<Bytes> BPSPatch::apply(const Bytes& source, const PatchOptions& options) const {
-
+Result<Bytes> BPSPatch::apply(std::span<const Byte> source, const PatchOptions& options) const {
+    // checked here too so a bad source fails before allocating the target
     if (source.size() != impl_->src_size) {
         return ErrorInfo{ErrorCode::SourceSizeMismatch, 
             "Source size mismatch: expected " + std::to_string(impl_->src_size) +
             ", got " + std::to_string(source.size())};
     }
     
-    if (options.verify_checksums) {
-        std::uint32_t actual_src_crc = calc_crc32(source);
-        if (actual_src_crc != impl_->src_crc) {
-            return ErrorInfo{ErrorCode::ChecksumMismatch, 
-                "Source CRC32 mismatch: expected " + std::to_string(impl_->src_crc) +
-                ", got " + std::to_string(actual_src_crc)};
-        }
+    Bytes output(impl_->target_size);
+    auto result = impl_->apply_into(source, output, options, std::nullopt);
+    if (!result) {
+        return result.error();
     }
-    
-    Bytes output;
-    output.reserve(impl_->target_size);
-    
-    std::size_t source_rel_offset = 0;
-    std::size_t target_rel_offset = 0;
-    std::size_t patch_data_offset = impl_->data_offset;
-    
-    for (const auto& cmd : impl_->commands) {
-        switch (cmd.action) {
-            case Impl::Action::SourceRead: {
-                if (source_rel_offset + cmd.length > source.size()) {
-                    return ErrorInfo{ErrorCode::InvalidPatchFormat, "SourceRead exceeds source size"};
-                }
-                output.insert(output.end(), 
-                    source.begin() + source_rel_offset,
-                    source.begin() + source_rel_offset + cmd.length);
-                source_rel_offset += cmd.length;
-                break;
-            }
-            
-            case Impl::Action::TargetRead: {
-                if (patch_data_offset + cmd.length > impl_->patch_data.size() - 12) {
-                    return ErrorInfo{ErrorCode::InvalidPatchFormat, "TargetRead exceeds patch data"};
-                }
-                output.insert(output.end(),
-                    impl_->patch_data.begin() + patch_data_offset,
-                    impl_->patch_data.begin() + patch_data_offset + cmd.length);
-                patch_data_offset += cmd.length;
-                break;
-            }
-            
-            case Impl::Action::SourceCopy: {
-                std::int64_t offset = static_cast<std::int64_t>(source_rel_offset) + 
-                                     ((cmd.offset_delta & 1) ? -static_cast<std::int64_t>(cmd.offset_delta >> 1) 
-                                                              : static_cast<std::int64_t>(cmd.offset_delta >> 1));
-                if (offset < 0 || static_cast<std::size_t>(offset) + cmd.length > source.size()) {
-                    return ErrorInfo{ErrorCode::InvalidPatchFormat, "SourceCopy offset out of bounds"};
-                }
-                source_rel_offset = offset;
-                output.insert(output.end(),
-                    source.begin() + offset,
-                    source.begin() + offset + cmd.length);
-                source_rel_offset += cmd.length;
-                break;
-            }
-            
-            case Impl::Action::TargetCopy: {
-                std::int64_t offset = static_cast<std::int64_t>(target_rel_offset) + 
-                                     ((cmd.offset_delta & 1) ? -static_cast<std::int64_t>(cmd.offset_delta >> 1) 
-                                                              : static_cast<std::int64_t>(cmd.offset_delta >> 1));
-                if (offset < 0 || static_cast<std::size_t>(offset) >= output.size()) {
-                    return ErrorInfo{ErrorCode::InvalidPatchFormat, "TargetCopy offset out of bounds"};
-                }
+    return output;
+}
 
-                target_rel_offset = offset;
+Result<std::size_t> BPSPatch::output_size(std::span<const Byte>) const {
+    return impl_->target_size;
+}
 
-                for (std::uint64_t i = 0; i < cmd.length; ++i) {
-                    if (static_cast<std::size_t>(offset + i) >= output.size()) {
-                        return ErrorInfo{ErrorCode::InvalidPatchFormat, "TargetCopy exceeds output size"};
-                    }
-                    output.push_back(output[offset + i]);
-                }
-                target_rel_offset += cmd.length;
-                break;
-            }
-        }
+Result<void> BPSPatch::apply_into(std::span<const Byte> source, std::span<Byte> target, const PatchOptions& options) const {
+    return impl_->apply_into(source, target, options, std::nullopt);
+}
+
+Result<void> BPSPatch::apply_streaming(std::span<const Byte> source, FileWriter& writer, const PatchOptions& options) const {
+    return impl_->apply_streaming(source, writer, options, std::nullopt);
+}
+
+Result<void> BPSPatch::apply_to_file(
+    const std::string& source_path,
+    const std::string& output_path,
+    const PatchOptions& options
+) const {
+
+    // taken before the source is read, for storing its checksum afterwards
+    auto source_id = get_file_identity(source_path);
+    auto known_src_crc = cached_file_crc32(source_path, options);
+    
+    // the engine reads the source straight out of the reader, mapped or not
+    auto source_result = open_file_reader(source_path, options);
+    if (!source_result) {
+        return source_result.error();
+    }
+    auto& source_reader = source_result.value();
+    auto source_size = source_reader->size();
+    if (!source_size) {
+        return source_size.error();
+    }
+    auto source_view = source_reader->read_view(0, source_size.value());
+    if (!source_view) {
+        return source_view.error();
     }
+    std::span<const Byte> source = source_view.value();
+    FileReader* hinted_reader = options.access_hints ? source_reader.get() : nullptr;
     
-    if (output.size() != impl_->target_size) {
-        return ErrorInfo{ErrorCode::InvalidPatchFormat,
-            "Output size mismatch: expected " + std::to_string(impl_->target_size) +
-            ", got " + std::to_string(output.size())};
+    if (source.size() != impl_->src_size) {
+        return ErrorInfo{ErrorCode::SourceSizeMismatch, 
+            "Source size mismatch: expected " + std::to_string(impl_->src_size) +
+            ", got " + std::to_string(source.size())};
     }
     
-    if (options.verify_checksums) {
-        std::uint32_t actual_target_crc = calc_crc32(output);
-        if (actual_target_crc != impl_->target_crc) {
-            return ErrorInfo{ErrorCode::ChecksumMismatch,
-                "Target CRC32 mismatch: expected " + std::to_string(impl_->target_crc) +
-                ", got " + std::to_string(actual_target_crc)};
+    Result<void> write_result;
+    if (options.stream_window_size > 0 && impl_->target_size > options.stream_window_size) {
+        // too big to hold, stream it into a temp file that replaces the
+        // output once the whole target checked out
+        std::string temp_path = output_path + ".partial";
+        std::error_code ec;
+        auto writer_result = create_file_writer(temp_path, options);
+        if (!writer_result) {
+            return writer_result.error();
+        }
+        write_result = impl_->apply_streaming(source, *writer_result.value(), options, known_src_crc, hinted_reader);
+        if (write_result) {
+            write_result = writer_result.value()->close();
+        }
+        writer_result.value().reset();
+        if (write_result) {
+            std::filesystem::rename(temp_path, output_path, ec);
+            if (ec) {
+                write_result = ErrorInfo{ErrorCode::FileWriteError, "Cannot replace file: " + output_path};
+            }
         }
+        if (!write_result) {
+            std::filesystem::remove(temp_path, ec);
+        }
+    } else {
+        // the target is produced straight into the output file (mapped when
+        // options allow) rather than into a buffer that is then written out
+        write_result = fill_file(output_path, impl_->target_size, [&](std::span<Byte> target) {
+            return impl_->apply_into(source, target, options, known_src_crc, hinted_reader);
+        }, options);
     }
-    
-    return output;
-}
-
-Result<void> BPSPatch::apply_to_file( const std::string& source_path, const std::string& output_path, const PatchOptions& options) const {
-    
-    auto source_result = read_file(source_path);
-    if (!source_result) {
-        return source_result.error();
+    if (!write_result) {
+        return write_result;
     }
     
-    auto patched_result = apply(source_result.value(), options);
-    if (!patched_result) {
-        return patched_result.error();
+    // apply just checked the source against src_crc, remember that
+    if (source_id && !known_src_crc) {
+        store_file_crc32(source_path, source_id.value(), impl_->src_crc, options);
     }
     
-    auto& patched_data = patched_result.value();
-    return write_file(output_path, std::span<const Byte>(patched_data.data(), patched_data.size()));
+    return Result<void>{};
 }
 
 Result<void> BPSPatch::validate() const {
@@ -277,7 +806,8 @@ Result<void> BPSPatch::validate() const {
         return ErrorInfo{ErrorCode::InvalidPatchHeader, "Invalid BPS header"};
     }
     
-    Bytes data_to_check(impl_->patch_data.begin(), impl_->patch_data.end() - 4);
+    // everything but the trailing patch crc itself, hashed in place
+    std::span<const Byte> data_to_check(impl_->patch_data.data(), impl_->patch_data.size() - 4);
     std::uint32_t calculated_crc = calc_crc32(data_to_check);
     
     if (calculated_crc != impl_->patch_crc) {
@@ -1,6 +1,13 @@
 #include "iubpatch/formats/ips.h"
 #include "iubpatch/io.h"
+#include "patch_file.h"
 #include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+#include <queue>
+#include <system_error>
+#include <thread>
 
 namespace iubpatch {
 
@@ -13,27 +20,39 @@ static constexpr std::size_t IPS_RECORD_HEADER_SIZE = 5;
 
 class IPSPatch::Impl {
 public:
-    Bytes patch_data;
+    // view of the patch bytes, owner keeps whatever backs them alive
+    std::span<const Byte> patch_data;
+    std::shared_ptr<const void> owner;
     bool is_ips32_format = false;
     
+    // one fixed size entry per record, the payloads stay in patch_data
     struct Record {
         std::uint32_t offset;
-        std::uint16_t size;
+        std::uint32_t length;
+        std::uint32_t payload;  // where the data starts in patch_data, or the RLE fill byte
         bool is_rle;
-        std::uint16_t rle_size;
-        Byte rle_value;
-        std::vector<Byte> data;
     };
 
-    std::vector<Record> records;
+    // the records compiled down to what the output ends up as: sorted by
+    // offset, never overlapping, with later records already cut out of the
+    // earlier ones they cover. neighbours that continue each other (same
+    // RLE byte, or payloads back to back in the patch) are merged
+    std::vector<Record> extents;
+    // end of the furthest record, the size the patch grows the output to
+    std::size_t target_end = 0;
     
-    Result<void> parse() {
-        records.clear();
-        
-        if (patch_data.size() < IPS_HEADER_SIZE + IPS_EOF_SIZE) {
-            return ErrorInfo{ErrorCode::InvalidPatchFormat, "IPS patch too small"};
-        }
-        
+    // IPS32 offsets go up to 4GB, so ends don't fit the 32-bit fields
+    static std::size_t end_of(const Record& rec) {
+        return static_cast<std::size_t>(rec.offset) + rec.length;
+    }
+    
+    std::span<const Byte> payload(const Record& rec) const {
+        return patch_data.subspan(rec.payload, rec.length);
+    }
+    
+    // walks the records, handing each one to visit. stops at EOF
+    template <typename Visit>
+    Result<void> scan(Visit&& visit) {
         std::size_t offset = IPS_HEADER_SIZE;
         
         while (offset + 3 <= patch_data.size()) {
@@ -57,41 +76,213 @@ public:
                         static_cast<std::uint32_t>(patch_data[offset + 2]);
             offset += 3;
             
-            rec.size = (static_cast<std::uint16_t>(patch_data[offset]) << 8) |
-                      static_cast<std::uint16_t>(patch_data[offset + 1]);
+            rec.length = (static_cast<std::uint32_t>(patch_data[offset]) << 8) |
+                         static_cast<std::uint32_t>(patch_data[offset + 1]);
             offset += 2;
             
-            if (rec.size == 0) {
+            if (rec.length == 0) {
 
                 if (offset + 3 > patch_data.size()) {
                     return ErrorInfo{ErrorCode::CorruptedPatchData, "Truncated RLE record"};
                 }
                 rec.is_rle = true;
-                rec.rle_size = (static_cast<std::uint16_t>(patch_data[offset]) << 8) |
-                              static_cast<std::uint16_t>(patch_data[offset + 1]);
-                rec.rle_value = patch_data[offset + 2];
+                rec.length = (static_cast<std::uint32_t>(patch_data[offset]) << 8) |
+                             static_cast<std::uint32_t>(patch_data[offset + 1]);
+                rec.payload = patch_data[offset + 2];
                 offset += 3;
             } else {
 
-                if (offset + rec.size > patch_data.size()) {
+                if (offset + rec.length > patch_data.size()) {
                     return ErrorInfo{ErrorCode::CorruptedPatchData, "Truncated data record"};
                 }
                 rec.is_rle = false;
-                rec.data.assign(patch_data.begin() + offset, patch_data.begin() + offset + rec.size);
-                offset += rec.size;
+                rec.payload = static_cast<std::uint32_t>(offset);
+                offset += rec.length;
             }
             
-            records.push_back(std::move(rec));
+            visit(rec);
+        }
+        
+        return Result<void>{};
+    }
+    
+    Result<void> parse() {
+        extents.clear();
+        target_end = 0;
+        
+        if (patch_data.size() < IPS_HEADER_SIZE + IPS_EOF_SIZE) {
+            return ErrorInfo{ErrorCode::InvalidPatchFormat, "IPS patch too small"};
         }
         
+        // payload positions are kept in 32 bits
+        if (patch_data.size() > UINT32_MAX) {
+            return ErrorInfo{ErrorCode::PatchTooLarge, "IPS patch over 4GB"};
+        }
+        
+        // counting first sizes the table in one allocation, the second
+        // pass only reads headers that are already in cache
+        std::size_t count = 0;
+        auto counted = scan([&count](const Record&) { ++count; });
+        if (!counted) {
+            return counted;
+        }
+        std::vector<Record> records;
+        records.reserve(count);
+        auto scanned = scan([&records](const Record& rec) { records.push_back(rec); });
+        if (!scanned) {
+            return scanned;
+        }
+        compile(records);
         return Result<void>{};
     }
+    
+    void compile(const std::vector<Record>& records) {
+        bool ordered = true;
+        std::size_t last_end = 0;
+        for (const auto& rec : records) {
+            target_end = std::max(target_end, end_of(rec));
+            if (rec.length > 0) {
+                ordered = ordered && rec.offset >= last_end;
+                last_end = end_of(rec);
+            }
+        }
+        
+        if (ordered) {
+            // the usual case, records already go front to back
+            extents.reserve(records.size());
+            for (const auto& rec : records) {
+                append_extent(rec);
+            }
+            return;
+        }
+        
+        // sweep the records by offset keeping the ones that cover pos in
+        // a heap, newest on top. the newest one wins until it ends or
+        // another record starts, the pieces come out in order
+        std::vector<std::uint64_t> starts;
+        starts.reserve(records.size());
+        for (std::uint32_t i = 0; i < records.size(); ++i) {
+            if (records[i].length > 0) {
+                starts.push_back(static_cast<std::uint64_t>(records[i].offset) << 32 | i);
+            }
+        }
+        sort_starts(starts);
+        auto start_of = [&starts](std::size_t k) { return static_cast<std::size_t>(starts[k] >> 32); };
+        
+        std::priority_queue<std::uint32_t> covering;
+        std::size_t next = 0;
+        std::size_t pos = 0;
+        extents.reserve(records.size());
+        while (true) {
+            for (; next < starts.size() && start_of(next) <= pos; ++next) {
+                covering.push(static_cast<std::uint32_t>(starts[next]));
+            }
+            while (!covering.empty() && end_of(records[covering.top()]) <= pos) {
+                covering.pop();
+            }
+            if (covering.empty()) {
+                if (next == starts.size()) {
+                    break;
+                }
+                pos = start_of(next);  // nothing patches the gap
+                continue;
+            }
+            
+            const Record& winner = records[covering.top()];
+            std::size_t stop = end_of(records[covering.top()]);
+            if (next < starts.size()) {
+                stop = std::min(stop, start_of(next));
+            }
+            Record piece = winner;
+            piece.offset = static_cast<std::uint32_t>(pos);
+            piece.length = static_cast<std::uint32_t>(stop - pos);
+            if (!winner.is_rle) {
+                piece.payload += static_cast<std::uint32_t>(pos - winner.offset);
+            }
+            append_extent(piece);
+            pos = stop;
+        }
+    }
+    
+    // sorts offset << 32 | index keys by offset. a radix sort, 8 bits of
+    // offset per pass, since a comparison sort costs more than the whole
+    // scan on patches with tens of thousands of records
+    static void sort_starts(std::vector<std::uint64_t>& starts) {
+        std::uint64_t highest = 0;
+        for (auto key : starts) {
+            highest = std::max(highest, key);
+        }
+        std::vector<std::uint64_t> sorted(starts.size());
+        for (unsigned shift = 32; shift < 64 && (highest >> shift) != 0; shift += 8) {
+            std::size_t counts[257] = {};
+            for (auto key : starts) {
+                ++counts[((key >> shift) & 0xFF) + 1];
+            }
+            for (std::size_t i = 0; i < 256; ++i) {
+                counts[i + 1] += counts[i];
+            }
+            for (auto key : starts) {
+                sorted[counts[(key >> shift) & 0xFF]++] = key;
+            }
+            starts.swap(sorted);
+        }
+    }
+    
+    // rec starts at or after the end of the last extent
+    void append_extent(const Record& rec) {
+        if (rec.length == 0) {
+            return;
+        }
+        if (!extents.empty()) {
+            Record& last = extents.back();
+            bool continues = end_of(last) == rec.offset && last.is_rle == rec.is_rle &&
+                (rec.is_rle ? last.payload == rec.payload : last.payload + last.length == rec.payload);
+            if (continues) {
+                last.length += rec.length;
+                return;
+            }
+        }
+        extents.push_back(rec);
+    }
+    
+    // writes target[begin, end) in one pass: the extents where they are,
+    // the source in between, zeros past the end of the source
+    void fill(std::span<const Byte> source, std::span<Byte> target, std::size_t begin, std::size_t end) const {
+        auto extent = std::lower_bound(extents.begin(), extents.end(), begin, [](const Record& rec, std::size_t pos) {
+            return end_of(rec) <= pos;
+        });
+        
+        std::size_t pos = begin;
+        auto copy_source = [&](std::size_t to) {
+            std::size_t from_source = std::clamp(source.size(), pos, to);
+            if (from_source > pos) {
+                std::memcpy(target.data() + pos, source.data() + pos, from_source - pos);
+            }
+            if (to > from_source) {
+                std::memset(target.data() + from_source, 0, to - from_source);
+            }
+            pos = to;
+        };
+        
+        for (; extent != extents.end() && extent->offset < end; ++extent) {
+            std::size_t start = std::max<std::size_t>(extent->offset, begin);
+            std::size_t stop = std::min(end_of(*extent), end);
+            copy_source(start);
+            if (extent->is_rle) {
+                std::memset(target.data() + start, static_cast<Byte>(extent->payload), stop - start);
+            } else {
+                std::memcpy(target.data() + start, patch_data.data() + extent->payload + (start - extent->offset), stop - start);
+            }
+            pos = stop;
+        }
+        copy_source(end);
+    }
 };
 
 IPSPatch::IPSPatch() : impl_(std::make_unique<Impl>()) {}
 IPSPatch::~IPSPatch() = default;
 
-Result<std::unique_ptr<IPSPatch>> IPSPatch::load(const Bytes& patch_data) {
+Result<std::unique_ptr<IPSPatch>> IPSPatch::load(std::span<const Byte> patch_data, std::shared_ptr<const void> owner) {
     if (patch_data.size() < IPS_HEADER_SIZE + IPS_EOF_SIZE) {
         return ErrorInfo{ErrorCode::InvalidPatchFormat, "IPS patch too small"};
     }
@@ -102,6 +293,7 @@ Result<std::unique_ptr<IPSPatch>> IPSPatch::load(const Bytes& patch_data) {
     
     auto patch = std::unique_ptr<IPSPatch>(new IPSPatch());
     patch->impl_->patch_data = patch_data;
+    patch->impl_->owner = std::move(owner);
     
     auto parse_result = patch->impl_->parse();
     if (!parse_result) {
@@ -111,12 +303,17 @@ Result<std::unique_ptr<IPSPatch>> IPSPatch::load(const Bytes& patch_data) {
     return patch;
 }
 
-Result<std::unique_ptr<IPSPatch>> IPSPatch::load_from_file(const std::string& path) {
-    auto data_result = read_file(path);
-    if (!data_result) {
-        return data_result.error();
+Result<std::unique_ptr<IPSPatch>> IPSPatch::load(const Bytes& patch_data) {
+    auto owned = std::make_shared<const Bytes>(patch_data);
+    return load(std::span<const Byte>(*owned), owned);
+}
+
+Result<std::unique_ptr<IPSPatch>> IPSPatch::load_from_file(const std::string& path, const PatchOptions& options) {
+    auto file = detail::open_patch_file(path, options);
+    if (!file) {
+        return file.error();
     }
-    return load(data_result.value());
+    return load(file.value().data, std::move(file.value().owner));
 }
 
 Result<PatchMetadata> IPSPatch::get_metadata() const {
@@ -124,37 +321,71 @@ Result<PatchMetadata> IPSPatch::get_metadata() const {
     metadata.format = Format::IPS;
     metadata.has_checksums = false;
     
-    std::size_t max_offset = 0;
-    for (const auto& rec : impl_->records) {
-        std::size_t rec_end = rec.offset + (rec.is_rle ? rec.rle_size : rec.size);
-        if (rec_end > max_offset) {
-            max_offset = rec_end;
-        }
-    }
-    metadata.target_size = max_offset;
+    metadata.target_size = impl_->target_end;
     
     return metadata;
 }
 
-Result<Bytes> IPSPatch::apply(const Bytes& source, const PatchOptions& options) const {
+Result<Bytes> IPSPatch::apply(std::span<const Byte> source, const PatchOptions& options) const {
+    auto size_result = output_size(source);
+    if (!size_result) {
+        return size_result.error();
+    }
+    
+    Bytes output(size_result.value());
+    auto result = apply_into(source, output, options);
+    if (!result) {
+        return result.error();
+    }
+    return output;
+}
+
+Result<std::size_t> IPSPatch::output_size(std::span<const Byte> source) const {
+    // records can only grow the source
+    return std::max(source.size(), impl_->target_end);
+}
 
-    Bytes output = source;
+Result<void> IPSPatch::apply_into(std::span<const Byte> source, std::span<Byte> target, const PatchOptions& options) const {
+    auto size_result = output_size(source);
+    if (!size_result) {
+        return size_result.error();
+    }
+    if (target.size() != size_result.value()) {
+        return ErrorInfo{ErrorCode::InvalidArgument,
+            "Target buffer is " + std::to_string(target.size()) +
+            " bytes, patch produces " + std::to_string(size_result.value())};
+    }
     
-    for (const auto& rec : impl_->records) {
-        std::size_t required_size = rec.offset + (rec.is_rle ? rec.rle_size : rec.size);
-        
-        if (required_size > output.size()) {
-            output.resize(required_size);
-        }
-        
-        if (rec.is_rle) {
-            std::fill_n(output.begin() + rec.offset, rec.rle_size, rec.rle_value);
-        } else {
-            std::copy(rec.data.begin(), rec.data.end(), output.begin() + rec.offset);
+    // every byte is written once, from an extent or from the source. big
+    // outputs are split between threads, each filling its own part
+    constexpr std::size_t min_part_size = 4 << 20;
+    unsigned threads = options.apply_threads;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::size_t count = std::max<std::size_t>(1, std::min<std::size_t>(threads, target.size() / min_part_size));
+    std::size_t part_size = target.size() / count;
+    auto part = [&](std::size_t i) {
+        std::size_t begin = i * part_size;
+        impl_->fill(source, target, begin, (i + 1 == count) ? target.size() : begin + part_size);
+    };
+    
+    std::vector<std::thread> workers;
+    workers.reserve(count - 1);
+    for (std::size_t i = 1; i < count; ++i) {
+        try {
+            workers.emplace_back(part, i);
+        } catch (const std::system_error&) {
+            // out of threads, fill it here instead
+            part(i);
         }
     }
+    part(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
     
-    return output;
+    return Result<void>{};
 }
 
 Result<void> IPSPatch::apply_to_file(
@@ -163,18 +394,83 @@ Result<void> IPSPatch::apply_to_file(
     const PatchOptions& options
 ) const {
 
-    auto source_result = read_file(source_path);
+    // the engine reads the source straight out of the reader, mapped or not
+    auto source_result = open_file_reader(source_path, options);
     if (!source_result) {
         return source_result.error();
     }
+    auto& source_reader = source_result.value();
+    auto source_size = source_reader->size();
+    if (!source_size) {
+        return source_size.error();
+    }
+    auto source_view = source_reader->read_view(0, source_size.value());
+    if (!source_view) {
+        return source_view.error();
+    }
+    std::span<const Byte> source = source_view.value();
+    
+    auto size_result = output_size(source);
+    if (!size_result) {
+        return size_result.error();
+    }
     
-    auto patched_result = apply(source_result.value(), options);
-    if (!patched_result) {
-        return patched_result.error();
+    // the whole source is copied before the first record, so it can all
+    // be on its way in while the output file is set up
+    if (options.access_hints) {
+        source_reader->advise(0, source.size(), AccessHint::WillNeed);
     }
     
-    auto& patched_data = patched_result.value();
-    return write_file(output_path, std::span<const Byte>(patched_data.data(), patched_data.size()));
+    // patched straight into the output file (mapped when options allow)
+    return fill_file(output_path, size_result.value(), [&](std::span<Byte> target) {
+        return apply_into(source, target, options);
+    }, options);
+}
+
+Result<void> IPSPatch::apply_in_place(const std::string& file_path, const PatchOptions& options) const {
+    if (options.sparse_inplace == PatchOptions::SparseInPlace::Off) {
+        return Patch::apply_in_place(file_path, options);
+    }
+    
+    std::error_code ec;
+    auto file_size = std::filesystem::file_size(file_path, ec);
+    if (ec) {
+        return ErrorInfo{ErrorCode::FileNotFound, "Cannot stat file: " + file_path};
+    }
+    
+    // extents overwrite fixed ranges regardless of what was there, so the
+    // source never has to be read. writes past the end grow the file, any
+    // gap reads back as zeros like apply() fills it
+    auto last = options.sparse_inplace == PatchOptions::SparseInPlace::Clone ? CopyMethod::Clone : CopyMethod::Buffered;
+    auto result = edit_file_copy(file_path, [this, file_size](FileWriter& target) -> Result<void> {
+        std::size_t written_end = file_size;
+        Bytes run;
+        for (const auto& rec : impl_->extents) {
+            Result<void> result;
+            if (rec.is_rle) {
+                run.assign(rec.length, static_cast<Byte>(rec.payload));
+                result = target.write_at(rec.offset, run);
+            } else {
+                result = target.write_at(rec.offset, impl_->payload(rec));
+            }
+            if (!result) {
+                return result;
+            }
+            written_end = std::max(written_end, Impl::end_of(rec));
+        }
+        // empty records still grow the output, and past every extent the
+        // last byte is a zero
+        if (impl_->target_end > written_end) {
+            const Byte zero[] = {0};
+            return target.write_at(impl_->target_end - 1, zero);
+        }
+        return Result<void>{};
+    }, options, last);
+    if (!result && result.error().code == ErrorCode::NotSupported) {
+        // no reflink, copying the file costs more than rewriting it
+        return Patch::apply_in_place(file_path, options);
+    }
+    return result;
 }
 
 Result<void> IPSPatch::validate() const {
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "iubpatch/io.h"
+#include "iubpatch/options.h"
+#include <memory>
+#include <span>
+#include <string>
+
+namespace iubpatch::detail {
+
+// a patch file opened for parsing in place: data stays valid for as long
+// as owner, the reader it came from, is alive
+struct PatchFileView {
+    std::span<const Byte> data;
+    std::shared_ptr<const void> owner;
+};
+
+// opens path with open_file_reader (mapped when options allow) and views
+// all of it. patches keep owner alive instead of copying their contents
+Result<PatchFileView> open_patch_file(const std::string& path, const PatchOptions& options);
+
+} // namespace iubpatch::detail
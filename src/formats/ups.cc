@@ -1,9 +1,31 @@
 #include "iubpatch/formats/ups.h"
 #include "iubpatch/io.h"
 #include "iubpatch/crc32.h"
+#include "iubpatch/checksum_cache.h"
+#include "patch_file.h"
+#include "varint.h"
 #include <cstdint>
 #include <cstring>
 #include <algorithm>
+#include <bit>
+#include <optional>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IUB_UPS_SSE2 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define IUB_UPS_AVX2 1
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define IUB_UPS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define IUB_TARGET(x) __attribute__((target(x)))
+#else
+#define IUB_TARGET(x)
+#endif
 
 namespace iubpatch {
 
@@ -11,67 +33,388 @@ namespace iubpatch {
 static constexpr char UPS_MAGIC[] = "UPS1";
 static constexpr std::size_t UPS_HEADER_SIZE = 4;
 
-static std::uint64_t decode_variable_len(const Bytes& data, std::size_t& offset) {
-    std::uint64_t value = 0;
-    std::uint64_t shift = 1;
-    
-    while (offset < data.size()) {
-        std::uint64_t byte = data[offset++];
-        value += (byte & 0x7F) * shift;
-        if (byte & 0x80) break;
-        shift <<= 7;
-        value += shift;
+namespace {
+
+// the two loops UPS spends its time in: finding the 0x00 that ends each
+// hunk, and XOR-ing a hunk onto the source. SSE2 and NEON are always there
+// on x86-64 and aarch64, AVX2 is picked at runtime
+
+// first zero byte in [p, end), end if there is none
+using FindZeroFn = const Byte* (*)(const Byte*, const Byte*);
+// out[i] = a[i] ^ b[i], out may be a
+using XorFn = void (*)(Byte*, const Byte*, const Byte*, std::size_t);
+
+struct Kernels {
+    FindZeroFn find_zero;
+    XorFn xor_bytes;
+};
+
+[[maybe_unused]] const Byte* find_zero_scalar(const Byte* p, const Byte* end) {
+    if (p == end) {
+        return end;
     }
-    
-    return value;
+    auto found = static_cast<const Byte*>(std::memchr(p, 0, static_cast<std::size_t>(end - p)));
+    return found ? found : end;
+}
+
+void xor_bytes_scalar(Byte* out, const Byte* a, const Byte* b, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = a[i] ^ b[i];
+    }
+}
+
+#ifdef IUB_UPS_SSE2
+
+const Byte* find_zero_sse2(const Byte* p, const Byte* end) {
+    const __m128i zero = _mm_setzero_si128();
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+        if (mask) {
+            return p + std::countr_zero(mask);
+        }
+        p += 16;
+    }
+    while (p < end && *p) {
+        ++p;
+    }
+    return p;
+}
+
+void xor_bytes_sse2(Byte* out, const Byte* a, const Byte* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(x, y));
+    }
+    xor_bytes_scalar(out + i, a + i, b + i, n - i);
+}
+
+#endif // IUB_UPS_SSE2
+
+#ifdef IUB_UPS_AVX2
+
+IUB_TARGET("avx2")
+const Byte* find_zero_avx2(const Byte* p, const Byte* end) {
+    const __m256i zero = _mm256_setzero_si256();
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+        if (mask) {
+            return p + std::countr_zero(mask);
+        }
+        p += 32;
+    }
+    return find_zero_sse2(p, end);
+}
+
+IUB_TARGET("avx2")
+void xor_bytes_avx2(Byte* out, const Byte* a, const Byte* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_xor_si256(x, y));
+    }
+    xor_bytes_sse2(out + i, a + i, b + i, n - i);
+}
+
+bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif // IUB_UPS_AVX2
+
+#ifdef IUB_UPS_NEON
+
+const Byte* find_zero_neon(const Byte* p, const Byte* end) {
+    while (end - p >= 16) {
+        uint8x16_t eq = vceqzq_u8(vld1q_u8(p));
+        if (vmaxvq_u8(eq)) {
+            std::uint64_t lo = vgetq_lane_u64(vreinterpretq_u64_u8(eq), 0);
+            if (lo) {
+                return p + std::countr_zero(lo) / 8;
+            }
+            std::uint64_t hi = vgetq_lane_u64(vreinterpretq_u64_u8(eq), 1);
+            return p + 8 + std::countr_zero(hi) / 8;
+        }
+        p += 16;
+    }
+    while (p < end && *p) {
+        ++p;
+    }
+    return p;
+}
+
+void xor_bytes_neon(Byte* out, const Byte* a, const Byte* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u8(out + i, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+    xor_bytes_scalar(out + i, a + i, b + i, n - i);
 }
 
+#endif // IUB_UPS_NEON
+
+Kernels select_kernels() {
+#ifdef IUB_UPS_AVX2
+    if (cpu_has_avx2()) {
+        return {find_zero_avx2, xor_bytes_avx2};
+    }
+#endif
+#if defined(IUB_UPS_SSE2)
+    return {find_zero_sse2, xor_bytes_sse2};
+#elif defined(IUB_UPS_NEON)
+    return {find_zero_neon, xor_bytes_neon};
+#else
+    return {find_zero_scalar, xor_bytes_scalar};
+#endif
+}
+
+const Kernels& kernels() {
+    static const Kernels selected = select_kernels();
+    return selected;
+}
+
+} // namespace
+
 class UPSPatch::Impl {
 public:
-    Bytes patch_data;
+    // view of the patch bytes, owner keeps whatever backs them alive
+    std::span<const Byte> patch_data;
+    std::shared_ptr<const void> owner;
     std::size_t src_size = 0;
     std::size_t target_size = 0;
     std::uint32_t src_crc = 0;
     std::uint32_t target_crc = 0;
     std::uint32_t patch_crc = 0;
     
+    // a hunk of the target to XOR, its bytes stay in patch_data
     struct XORBlock {
         std::size_t offset;
-        Bytes data;
+        std::size_t payload;
+        std::size_t length;
     };
     std::vector<XORBlock> blocks;
     
-    Result<void> parse() {
+    const Byte* payload(const XORBlock& block) const {
+        return patch_data.data() + block.payload;
+    }
+    
+    // known_src_crc: the source checksum is already known (checksum cache),
+    // use it instead of hashing the source
+    Result<void> apply_into(std::span<const Byte> source, std::span<Byte> output, const PatchOptions& options,
+                            std::optional<std::uint32_t> known_src_crc) const {
+        
+        if (output.size() != target_size) {
+            return ErrorInfo{ErrorCode::InvalidArgument,
+                "Target buffer is " + std::to_string(output.size()) +
+                " bytes, patch produces " + std::to_string(target_size)};
+        }
+        
+        // with threads to spare the source hash overlaps the patching,
+        // otherwise it is checked up front before any work is done
+        std::future<std::uint32_t> pending_src_crc;
+        if (options.verify_checksums) {
+            if (source.size() != src_size) {
+                return ErrorInfo{ErrorCode::SourceSizeMismatch, 
+                    "Source size mismatch: expected " + std::to_string(src_size) + 
+                    ", got " + std::to_string(source.size())};
+            }
+            
+            if (known_src_crc) {
+                if (*known_src_crc != src_crc) {
+                    return ErrorInfo{ErrorCode::ChecksumMismatch, "Source CRC32 mismatch"};
+                }
+            } else if (options.checksum_threads != 1) {
+                pending_src_crc = calc_crc32_async(source, options.checksum_threads);
+            } else if (calc_crc32(source) != src_crc) {
+                return ErrorInfo{ErrorCode::ChecksumMismatch, "Source CRC32 mismatch"};
+            }
+        }
+        
+        // output is built front to back in one pass, each stretch is hashed
+        // right after it is written. past the end of the source the output
+        // starts out as zeros
+        Crc32 output_crc;
+        std::size_t cursor = 0;
+        
+        auto copy_source_until = [&](std::size_t end) {
+            end = std::min(end, target_size);
+            if (end <= cursor) {
+                return;
+            }
+            std::size_t copy_end = std::min(end, source.size());
+            if (copy_end > cursor) {
+                std::memcpy(&output[cursor], &source[cursor], copy_end - cursor);
+            }
+            std::size_t zero_from = std::max(copy_end, cursor);
+            if (end > zero_from) {
+                std::memset(&output[zero_from], 0, end - zero_from);
+            }
+            if (options.verify_checksums) {
+                output_crc.update({&output[cursor], end - cursor});
+            }
+            cursor = end;
+        };
+        
+        const auto& kernel = kernels();
+        for (const auto& block : blocks) {
+            if (block.offset >= target_size) {
+                break;
+            }
+            copy_source_until(block.offset);
+            
+            // XOR where there is source, past it the hunk is the output
+            std::size_t end = std::min(block.offset + block.length, target_size);
+            std::size_t xor_end = std::clamp(source.size(), block.offset, end);
+            if (xor_end > block.offset) {
+                kernel.xor_bytes(&output[block.offset], &source[block.offset], payload(block), xor_end - block.offset);
+            }
+            if (end > xor_end) {
+                std::memcpy(&output[xor_end], payload(block) + (xor_end - block.offset), end - xor_end);
+            }
+            if (options.verify_checksums) {
+                output_crc.update({&output[block.offset], end - block.offset});
+            }
+            cursor = end;
+        }
+        copy_source_until(target_size);
+        
+        if (pending_src_crc.valid() && pending_src_crc.get() != src_crc) {
+            return ErrorInfo{ErrorCode::ChecksumMismatch, "Source CRC32 mismatch"};
+        }
+        
+        if (options.verify_checksums && output_crc.finalize() != target_crc) {
+            return ErrorInfo{ErrorCode::ChecksumMismatch, "Target CRC32 mismatch"};
+        }
+        
+        return Result<void>{};
+    }
+    
+    // in place patching for same size targets: target already holds a copy
+    // of source and only the XOR hunks are written. crc is linear, so with
+    // D = source ^ target (the hunk bytes, zero elsewhere)
+    //   crc(target) = crc(source) ^ raw_crc(D)
+    // where raw_crc(D) folds each hunk's raw crc shifted past the zeros
+    // after it. the target checksum is checked before anything is written
+    Result<void> apply_sparse(std::span<const Byte> source, FileWriter& target, const PatchOptions& options,
+                              std::optional<std::uint32_t> known_src_crc) const {
+        if (source.size() != src_size || src_size != target_size) {
+            return ErrorInfo{ErrorCode::SourceSizeMismatch, 
+                "Source size mismatch: expected " + std::to_string(src_size) + 
+                ", got " + std::to_string(source.size())};
+        }
+        
+        if (options.verify_checksums) {
+            std::uint32_t actual_src_crc = known_src_crc ? *known_src_crc : calc_crc32(source);
+            if (actual_src_crc != src_crc) {
+                return ErrorInfo{ErrorCode::ChecksumMismatch, "Source CRC32 mismatch"};
+            }
+            
+            std::uint32_t delta_crc = 0;
+            for (const auto& block : blocks) {
+                if (block.offset >= target_size) {
+                    break;
+                }
+                std::size_t end = std::min(block.offset + block.length, target_size);
+                std::uint32_t hunk_crc = crc32_update(0, {payload(block), end - block.offset});
+                delta_crc ^= crc32_combine(hunk_crc, 0, target_size - end);
+            }
+            if ((src_crc ^ delta_crc) != target_crc) {
+                return ErrorInfo{ErrorCode::ChecksumMismatch, "Target CRC32 mismatch"};
+            }
+        }
+        
+        const auto& kernel = kernels();
+        Bytes hunk;
+        for (const auto& block : blocks) {
+            if (block.offset >= target_size) {
+                break;
+            }
+            std::size_t end = std::min(block.offset + block.length, target_size);
+            hunk.resize(end - block.offset);
+            kernel.xor_bytes(hunk.data(), source.data() + block.offset, payload(block), hunk.size());
+            auto result = target.write_at(block.offset, hunk);
+            if (!result) {
+                return result;
+            }
+        }
+        
+        return Result<void>{};
+    }
+    
+    Result<void> parse(bool verify_patch_crc) {
         blocks.clear();
         
         if (patch_data.size() < UPS_HEADER_SIZE + 12) {
             return ErrorInfo{ErrorCode::InvalidPatchFormat, "UPS patch too small"};
         }
         
+        // with verify_patch_crc the patch checksum is folded in as the scan
+        // goes, a few KB at a time while those bytes are still in cache
+        Crc32 running_crc;
+        std::size_t hashed = 0;
+        auto hash_until = [&](std::size_t end, bool force) {
+            if (verify_patch_crc && (force || end - hashed >= 4096)) {
+                running_crc.update({patch_data.data() + hashed, end - hashed});
+                hashed = end;
+            }
+        };
+        
         std::size_t offset = UPS_HEADER_SIZE;
         
-        src_size = decode_variable_len(patch_data, offset);
-        target_size = decode_variable_len(patch_data, offset);
+        // none of the numbers can run into the checksums
+        auto hunks = patch_data.first(patch_data.size() - 12);
+        for (std::size_t* field : {&src_size, &target_size}) {
+            auto value = detail::decode_varint(hunks, offset);
+            if (!value) {
+                return value.error();
+            }
+            if (value.value() > SIZE_MAX) {
+                return ErrorInfo{ErrorCode::PatchTooLarge, "UPS header size does not fit in memory"};
+            }
+            *field = static_cast<std::size_t>(value.value());
+        }
         
+        const auto& kernel = kernels();
+        const Byte* hunks_end = hunks.data() + hunks.size();
         std::size_t file_offset = 0;
-        while (offset + 12 < patch_data.size()) {
-
-            std::uint64_t relative_offset = decode_variable_len(patch_data, offset);
-            file_offset += relative_offset;
+        while (offset < hunks.size()) {
+            std::uint64_t relative_offset = 0;
+            auto status = detail::read_varint(hunks, offset, relative_offset);
+            if (status != detail::VarintStatus::Ok) {
+                return detail::varint_error(status);
+            }
+            if (relative_offset > SIZE_MAX - file_offset) {
+                return ErrorInfo{ErrorCode::InvalidPatchOffset, "UPS hunk offset overflows"};
+            }
+            file_offset += static_cast<std::size_t>(relative_offset);
+            if (offset >= hunks.size()) {
+                break;
+            }
             
             XORBlock block;
             block.offset = file_offset;
+            block.payload = offset;
             
-            while (offset < patch_data.size() - 12) {
-                Byte b = patch_data[offset++];
-                if (b == 0x00) break;
-                block.data.push_back(b);
+            const Byte* hunk = patch_data.data() + offset;
+            const Byte* terminator = kernel.find_zero(hunk, hunks_end);
+            block.length = static_cast<std::size_t>(terminator - hunk);
+            offset += block.length;
+            file_offset += block.length;
+            if (terminator != hunks_end) {
+                // the terminator stands for an unchanged byte
+                offset++;
                 file_offset++;
             }
             
-            if (!block.data.empty()) {
-                blocks.push_back(std::move(block));
+            if (block.length > 0) {
+                blocks.push_back(block);
             }
+            hash_until(offset, false);
         }
         
         if (patch_data.size() >= 12) {
@@ -81,6 +424,13 @@ public:
             patch_crc = *reinterpret_cast<const std::uint32_t*>(&patch_data[crc_offset + 8]);
         }
         
+        if (verify_patch_crc) {
+            hash_until(patch_data.size() - 4, true);
+            if (running_crc.finalize() != patch_crc) {
+                return ErrorInfo{ErrorCode::ChecksumMismatch, "Patch CRC32 mismatch"};
+            }
+        }
+        
         return Result<void>{};
     }
 };
@@ -88,7 +438,7 @@ public:
 UPSPatch::UPSPatch() : impl_(std::make_unique<Impl>()) {}
 UPSPatch::~UPSPatch() = default;
 
-Result<std::unique_ptr<UPSPatch>> UPSPatch::load(const Bytes& patch_data) {
+Result<std::unique_ptr<UPSPatch>> UPSPatch::load(std::span<const Byte> patch_data, std::shared_ptr<const void> owner, bool verify_patch_crc) {
 
     if (patch_data.size() < UPS_HEADER_SIZE + 12) {
         return ErrorInfo{ErrorCode::InvalidPatchFormat, "UPS patch too small"};
@@ -100,8 +450,9 @@ Result<std::unique_ptr<UPSPatch>> UPSPatch::load(const Bytes& patch_data) {
     
     auto patch = std::unique_ptr<UPSPatch>(new UPSPatch());
     patch->impl_->patch_data = patch_data;
+    patch->impl_->owner = std::move(owner);
     
-    auto parse_result = patch->impl_->parse();
+    auto parse_result = patch->impl_->parse(verify_patch_crc);
     if (!parse_result) {
         return parse_result.error();
     }
@@ -109,14 +460,17 @@ Result<std::unique_ptr<UPSPatch>> UPSPatch::load(const Bytes& patch_data) {
     return patch;
 }
 
-Result<std::unique_ptr<UPSPatch>> UPSPatch::load_from_file(const std::string& path) {
-    auto data_result = read_file(path);
+Result<std::unique_ptr<UPSPatch>> UPSPatch::load(const Bytes& patch_data, bool verify_patch_crc) {
+    auto owned = std::make_shared<const Bytes>(patch_data);
+    return load(std::span<const Byte>(*owned), owned, verify_patch_crc);
+}
 
-    if (!data_result) {
-        return data_result.error();
+Result<std::unique_ptr<UPSPatch>> UPSPatch::load_from_file(const std::string& path, const PatchOptions& options) {
+    auto file = detail::open_patch_file(path, options);
+    if (!file) {
+        return file.error();
     }
-
-    return load(data_result.value());
+    return load(file.value().data, std::move(file.value().owner));
 }
 
 Result<PatchMetadata> UPSPatch::get_metadata() const {
@@ -131,63 +485,106 @@ Result<PatchMetadata> UPSPatch::get_metadata() const {
     return metadata;
 }
 
-Result<Bytes> UPSPatch::apply(const Bytes& source, const PatchOptions& options) const {
-
-    if (options.verify_checksums) {
-        if (source.size() != impl_->src_size) {
-            return ErrorInfo{ErrorCode::SourceSizeMismatch, 
-                "Source size mismatch: expected " + std::to_string(impl_->src_size) + 
-                ", got " + std::to_string(source.size())};
-        }
-        
-        auto src_crc = calc_crc32(source);
-        if (src_crc != impl_->src_crc) {
-            return ErrorInfo{ErrorCode::ChecksumMismatch, "Source CRC32 mismatch"};
-        }
+Result<Bytes> UPSPatch::apply(std::span<const Byte> source, const PatchOptions& options) const {
+    Bytes output(impl_->target_size);
+    auto result = impl_->apply_into(source, output, options, std::nullopt);
+    if (!result) {
+        return result.error();
     }
-    
-    Bytes output;
-    std::size_t max_size = std::max(source.size(), impl_->target_size);
-    output.resize(max_size);
-    
-    std::copy(source.begin(), source.end(), output.begin());
-    
-    for (const auto& block : impl_->blocks) {
-        for (std::size_t i = 0; i < block.data.size() && (block.offset + i) < output.size(); ++i) {
-            output[block.offset + i] ^= block.data[i];
-        }
-    }
-    
-    output.resize(impl_->target_size);
-    
-    if (options.verify_checksums) {
-        auto target_crc = calc_crc32(output);
-        if (target_crc != impl_->target_crc) {
-            return ErrorInfo{ErrorCode::ChecksumMismatch, "Target CRC32 mismatch"};
-        }
-    }
-    
     return output;
 }
 
+Result<std::size_t> UPSPatch::output_size(std::span<const Byte>) const {
+    return impl_->target_size;
+}
+
+Result<void> UPSPatch::apply_into(std::span<const Byte> source, std::span<Byte> target, const PatchOptions& options) const {
+    return impl_->apply_into(source, target, options, std::nullopt);
+}
+
 Result<void> UPSPatch::apply_to_file(
     const std::string& source_path,
     const std::string& output_path,
     const PatchOptions& options
 ) const {
 
-    auto source_result = read_file(source_path);
+    // taken before the source is read, for storing its checksum afterwards
+    auto source_id = get_file_identity(source_path);
+    auto known_src_crc = cached_file_crc32(source_path, options);
+    
+    // the engine reads the source straight out of the reader, mapped or not
+    auto source_result = open_file_reader(source_path, options);
     if (!source_result) {
         return source_result.error();
     }
+    auto& source_reader = source_result.value();
+    auto source_size = source_reader->size();
+    if (!source_size) {
+        return source_size.error();
+    }
+    auto source_view = source_reader->read_view(0, source_size.value());
+    if (!source_view) {
+        return source_view.error();
+    }
+    std::span<const Byte> source = source_view.value();
     
-    auto patched_result = apply(source_result.value(), options);
-    if (!patched_result) {
-        return patched_result.error();
+    // the target is produced straight into the output file (mapped when
+    // options allow) rather than into a buffer that is then written out
+    auto write_result = fill_file(output_path, impl_->target_size, [&](std::span<Byte> target) {
+        return impl_->apply_into(source, target, options, known_src_crc);
+    }, options);
+    if (!write_result) {
+        return write_result;
     }
     
-    auto& patched_data = patched_result.value();
-    return write_file(output_path, std::span<const Byte>(patched_data.data(), patched_data.size()));
+    // apply just checked the source against src_crc, remember that
+    if (source_id && !known_src_crc) {
+        store_file_crc32(source_path, source_id.value(), impl_->src_crc, options);
+    }
+    
+    return Result<void>{};
+}
+
+Result<void> UPSPatch::apply_in_place(const std::string& file_path, const PatchOptions& options) const {
+    // a size change rewrites the whole file anyway
+    if (options.sparse_inplace == PatchOptions::SparseInPlace::Off || impl_->src_size != impl_->target_size) {
+        return Patch::apply_in_place(file_path, options);
+    }
+    
+    // only the hunks' pages of the source are touched, unless the checksum
+    // has to be computed (served from the checksum cache if enabled). done
+    // once the clone exists so a fallback doesn't read the source twice
+    auto last = options.sparse_inplace == PatchOptions::SparseInPlace::Clone ? CopyMethod::Clone : CopyMethod::Buffered;
+    auto result = edit_file_copy(file_path, [&](FileWriter& target) -> Result<void> {
+        std::optional<std::uint32_t> known_src_crc;
+        if (options.verify_checksums) {
+            auto crc_result = file_crc32(file_path, options);
+            if (!crc_result) {
+                return crc_result.error();
+            }
+            known_src_crc = crc_result.value();
+        }
+        
+        auto source_result = open_file_reader(file_path, options);
+        if (!source_result) {
+            return source_result.error();
+        }
+        auto& source_reader = source_result.value();
+        auto source_size = source_reader->size();
+        if (!source_size) {
+            return source_size.error();
+        }
+        auto source_view = source_reader->read_view(0, source_size.value());
+        if (!source_view) {
+            return source_view.error();
+        }
+        return impl_->apply_sparse(source_view.value(), target, options, known_src_crc);
+    }, options, last);
+    if (!result && result.error().code == ErrorCode::NotSupported) {
+        // no reflink, copying the file costs more than rewriting it
+        return Patch::apply_in_place(file_path, options);
+    }
+    return result;
 }
 
 Result<void> UPSPatch::validate() const {
@@ -199,7 +596,8 @@ Result<void> UPSPatch::validate() const {
         return ErrorInfo{ErrorCode::InvalidPatchHeader, "Invalid UPS header"};
     }
     
-    Bytes patch_without_crc(impl_->patch_data.begin(), impl_->patch_data.end() - 4);
+    // everything but the trailing patch crc itself, hashed in place
+    std::span<const Byte> patch_without_crc(impl_->patch_data.data(), impl_->patch_data.size() - 4);
     auto calculated_crc = calc_crc32(patch_without_crc);
     
     if (calculated_crc != impl_->patch_crc) {
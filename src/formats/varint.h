@@ -0,0 +1,114 @@
+#pragma once
+
+#include "iubpatch/errors.h"
+#include "iubpatch/patch.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace iubpatch::detail {
+
+// the variable-length numbers UPS and BPS share: 7 bits per byte, low
+// bits first, the last byte has its top bit set, and every continuation
+// also adds one so each value has exactly one encoding
+
+// what a number of n bytes starts at, the sum of 1 << 7i for 0 < i < n
+inline constexpr std::uint64_t VARINT_BASE[9] = {
+    0, 0,
+    0x80ull,
+    0x4080ull,
+    0x204080ull,
+    0x10204080ull,
+    0x0810204080ull,
+    0x040810204080ull,
+    0x02040810204080ull,
+};
+
+enum class VarintStatus {
+    Ok,
+    Truncated,
+    Overflow
+};
+
+// byte at a time, checking every bound. only taken near the end of the
+// data and for numbers longer than 8 bytes
+inline VarintStatus read_varint_slow(std::span<const Byte> data, std::size_t& offset, std::uint64_t& out) {
+    std::uint64_t value = 0;
+    unsigned shift = 0;
+    for (std::size_t i = offset; i < data.size(); ++i) {
+        std::uint64_t bits = data[i] & 0x7F;
+        if (bits > (~std::uint64_t{0} >> shift)) {
+            return VarintStatus::Overflow;
+        }
+        bits <<= shift;
+        value += bits;
+        if (value < bits) {
+            return VarintStatus::Overflow;
+        }
+        if (data[i] & 0x80) {
+            offset = i + 1;
+            out = value;
+            return VarintStatus::Ok;
+        }
+        shift += 7;
+        if (shift > 63) {
+            return VarintStatus::Overflow;
+        }
+        value += std::uint64_t{1} << shift;
+        if (value < (std::uint64_t{1} << shift)) {
+            return VarintStatus::Overflow;
+        }
+    }
+    return VarintStatus::Truncated;
+}
+
+// decodes the number at offset into out and moves offset past it, offset
+// is left alone on failure. with 8 bytes left the whole number is read as
+// one word: the terminator is the lowest set top bit, and the 7-bit groups
+// are packed together with three shifts
+inline VarintStatus read_varint(std::span<const Byte> data, std::size_t& offset, std::uint64_t& out) {
+    // command words and short offsets, by far the most common
+    if (offset < data.size() && (data[offset] & 0x80)) {
+        out = data[offset++] & 0x7F;
+        return VarintStatus::Ok;
+    }
+    if constexpr (std::endian::native == std::endian::little) {
+        if (offset < data.size() && data.size() - offset >= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, data.data() + offset, 8);
+            std::uint64_t stops = word & 0x8080808080808080ull;
+            if (stops != 0) {
+                unsigned bytes = static_cast<unsigned>(std::countr_zero(stops)) / 8 + 1;
+                // everything up to and including the terminator
+                std::uint64_t x = word & (stops ^ (stops - 1)) & 0x7F7F7F7F7F7F7F7Full;
+                x = ((x & 0x7F007F007F007F00ull) >> 1) | (x & 0x007F007F007F007Full);
+                x = ((x & 0x3FFF00003FFF0000ull) >> 2) | (x & 0x00003FFF00003FFFull);
+                x = ((x & 0x0FFFFFFF00000000ull) >> 4) | (x & 0x000000000FFFFFFFull);
+                offset += bytes;
+                out = x + VARINT_BASE[bytes];
+                return VarintStatus::Ok;
+            }
+        }
+    }
+    return read_varint_slow(data, offset, out);
+}
+
+inline ErrorInfo varint_error(VarintStatus status) {
+    if (status == VarintStatus::Overflow) {
+        return ErrorInfo{ErrorCode::InvalidPatchFormat, "Variable-length number overflows 64 bits"};
+    }
+    return ErrorInfo{ErrorCode::InvalidPatchFormat, "Truncated variable-length number"};
+}
+
+// read_varint for the places that aren't hot
+inline Result<std::uint64_t> decode_varint(std::span<const Byte> data, std::size_t& offset) {
+    std::uint64_t value = 0;
+    auto status = read_varint(data, offset, value);
+    if (status != VarintStatus::Ok) {
+        return varint_error(status);
+    }
+    return value;
+}
+
+} // namespace iubpatch::detail
@@ -1,12 +1,23 @@
 #include "iubpatch/io.h"
 #include <fstream>
+#include <filesystem>
+#include <utility>
+#include <algorithm>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
 
 #if defined(__unix__) || defined(__APPLE__)
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
 #elif defined(_WIN32)
 #include <windows.h>
 #endif
@@ -55,6 +66,8 @@ std::string PatchErrorCategory::message(int ev) const {
             return "Memory mapping failed";
         case ErrorCode::InvalidArgument:
             return "Invalid argument";
+        case ErrorCode::NotSupported:
+            return "Not supported";
         case ErrorCode::UnknownError:
         default:
             return "Unknown error";
@@ -75,8 +88,14 @@ public:
     Bytes data;
     std::size_t file_size = 0;
     
-    static Result<std::unique_ptr<BufferedFileReader>> open(const std::string& path) {
-        std::ifstream file(path, std::ios::binary | std::ios::ate);
+    static Result<std::unique_ptr<BufferedFileReader>> open(const std::string& path, std::size_t buffer_size) {
+        // the buffer has to be installed before the file is opened
+        std::vector<char> stream_buffer(buffer_size);
+        std::ifstream file;
+        if (buffer_size > 0) {
+            file.rdbuf()->pubsetbuf(stream_buffer.data(), stream_buffer.size());
+        }
+        file.open(path, std::ios::binary | std::ios::ate);
         if (!file) {
             return ErrorInfo{ErrorCode::FileNotFound, "Cannot open file: " + path};
         }
@@ -99,14 +118,19 @@ public:
 BufferedFileReader::BufferedFileReader() : impl_(std::make_unique<Impl>()) {}
 BufferedFileReader::~BufferedFileReader() = default;
 
-Result<std::unique_ptr<BufferedFileReader>> BufferedFileReader::open(const std::string& path) {
-    return Impl::open(path);
+Result<std::unique_ptr<BufferedFileReader>> BufferedFileReader::open(const std::string& path, std::size_t buffer_size) {
+    return Impl::open(path, buffer_size);
 }
 
 Result<Bytes> BufferedFileReader::read_all() {
     return impl_->data;
 }
 
+Bytes BufferedFileReader::take_all() {
+    impl_->file_size = 0;
+    return std::exchange(impl_->data, {});
+}
+
 Result<std::size_t> BufferedFileReader::size() const {
     return impl_->file_size;
 }
@@ -119,17 +143,299 @@ Result<Bytes> BufferedFileReader::read_range(std::size_t offset, std::size_t len
     return result;
 }
 
+Result<std::span<const Byte>> BufferedFileReader::read_view(std::size_t offset, std::size_t length) {
+    if (offset > impl_->file_size || length > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read range out of bounds"};
+    }
+    return std::span<const Byte>(impl_->data.data() + offset, length);
+}
+
 const Byte* BufferedFileReader::data() const {
     return impl_->data.data();
 }
 
+// O_DIRECT wants buffer address, file offset and length all aligned to the
+// logical block size, 4KB covers every common device
+static constexpr std::size_t DIRECT_ALIGNMENT = 4096;
+// each direct read or write waits for the device, so go in big pieces
+static constexpr std::size_t DIRECT_CHUNK_SIZE = 1 << 20;
+
+static std::size_t round_up_direct(std::size_t size) {
+    return (size + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+}
+
+#ifdef O_DIRECT
+struct AlignedFree {
+    void operator()(Byte* p) const noexcept { std::free(p); }
+};
+using AlignedBytes = std::unique_ptr<Byte[], AlignedFree>;
+
+// at least size bytes, rounded up to whole blocks, nullptr if out of memory
+static AlignedBytes allocate_direct(std::size_t size) {
+    return AlignedBytes(static_cast<Byte*>(std::aligned_alloc(DIRECT_ALIGNMENT, round_up_direct(std::max<std::size_t>(size, 1)))));
+}
+
+class DirectFileReader::Impl {
+public:
+    AlignedBytes data;
+    std::size_t file_size = 0;
+    
+    static Result<std::unique_ptr<Impl>> open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+        if (fd < 0) {
+            if (errno == EINVAL) {
+                return ErrorInfo{ErrorCode::NotSupported, "No direct I/O for file: " + path};
+            }
+            return ErrorInfo{ErrorCode::FileNotFound, "Cannot open file: " + path};
+        }
+        
+        auto impl = std::make_unique<Impl>();
+        auto result = impl->read(fd, path);
+        ::close(fd);
+        if (!result) {
+            return result.error();
+        }
+        return impl;
+    }
+    
+    Result<void> read(int fd, const std::string& path) {
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            return ErrorInfo{ErrorCode::FileReadError, "Cannot stat file: " + path};
+        }
+        file_size = static_cast<std::size_t>(st.st_size);
+        data = allocate_direct(file_size);
+        if (!data) {
+            return ErrorInfo{ErrorCode::OutOfMemory, "Cannot allocate read buffer for: " + path};
+        }
+        
+        // whole blocks at block offsets, the last read comes back short
+        std::size_t done = 0;
+        while (done < file_size) {
+            std::size_t n = std::min(DIRECT_CHUNK_SIZE, round_up_direct(file_size - done));
+            ssize_t got = ::pread(fd, data.get() + done, n, static_cast<off_t>(done));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0 && errno == EINVAL && done == 0) {
+                return ErrorInfo{ErrorCode::NotSupported, "No direct I/O for file: " + path};
+            }
+            if (got <= 0) {
+                return ErrorInfo{ErrorCode::FileReadError, "Cannot read file: " + path};
+            }
+            done += static_cast<std::size_t>(got);
+        }
+        return Result<void>{};
+    }
+};
+
+// writes data to path with O_DIRECT, the last block padded and then cut
+// off again. NotSupported if the filesystem refuses direct I/O
+static Result<void> write_file_direct(const std::string& path, std::span<const Byte> data) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+    if (fd < 0) {
+        if (errno == EINVAL) {
+            return ErrorInfo{ErrorCode::NotSupported, "No direct I/O for file: " + path};
+        }
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot create file: " + path};
+    }
+    
+    // data goes out as is where it happens to be aligned, anything else
+    // through a bounce buffer
+    bool aligned = reinterpret_cast<std::uintptr_t>(data.data()) % DIRECT_ALIGNMENT == 0;
+    AlignedBytes bounce;
+    Result<void> result;
+    std::size_t done = 0;
+    while (done < data.size() && result) {
+        std::size_t n = std::min(DIRECT_CHUNK_SIZE, data.size() - done);
+        std::size_t padded = round_up_direct(n);
+        const Byte* from = data.data() + done;
+        if (!aligned || padded != n) {
+            if (!bounce) {
+                bounce = allocate_direct(DIRECT_CHUNK_SIZE);
+                if (!bounce) {
+                    result = ErrorInfo{ErrorCode::OutOfMemory, "Cannot allocate write buffer for: " + path};
+                    break;
+                }
+            }
+            std::memcpy(bounce.get(), from, n);
+            std::memset(bounce.get() + n, 0, padded - n);
+            from = bounce.get();
+        }
+        
+        for (std::size_t written = 0; written < padded;) {
+            ssize_t w = ::pwrite(fd, from + written, padded - written, static_cast<off_t>(done + written));
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w < 0 && errno == EINVAL && done == 0) {
+                result = ErrorInfo{ErrorCode::NotSupported, "No direct I/O for file: " + path};
+            } else if (w <= 0) {
+                result = ErrorInfo{ErrorCode::FileWriteError, "Cannot write file: " + path};
+            }
+            if (!result) {
+                break;
+            }
+            written += static_cast<std::size_t>(w);
+        }
+        done += n;
+    }
+    
+    if (result && round_up_direct(data.size()) != data.size() && ftruncate(fd, static_cast<off_t>(data.size())) < 0) {
+        result = ErrorInfo{ErrorCode::FileWriteError, "Cannot size file: " + path};
+    }
+    if (::close(fd) < 0 && result) {
+        result = ErrorInfo{ErrorCode::FileWriteError, "Cannot write file: " + path};
+    }
+    return result;
+}
+#else
+class DirectFileReader::Impl {
+public:
+    std::unique_ptr<Byte[]> data;
+    std::size_t file_size = 0;
+    
+    static Result<std::unique_ptr<Impl>> open(const std::string& path) {
+        return ErrorInfo{ErrorCode::NotSupported, "No direct I/O for file: " + path};
+    }
+};
+
+static Result<void> write_file_direct(const std::string& path, std::span<const Byte>) {
+    return ErrorInfo{ErrorCode::NotSupported, "No direct I/O for file: " + path};
+}
+#endif
+
+DirectFileReader::DirectFileReader() : impl_(nullptr) {}
+DirectFileReader::~DirectFileReader() = default;
+
+Result<std::unique_ptr<DirectFileReader>> DirectFileReader::open(const std::string& path) {
+    auto impl_result = Impl::open(path);
+    if (!impl_result) {
+        return impl_result.error();
+    }
+    auto reader = std::unique_ptr<DirectFileReader>(new DirectFileReader());
+    reader->impl_ = std::move(impl_result.value());
+    return reader;
+}
+
+Result<Bytes> DirectFileReader::read_all() {
+    return Bytes(data(), data() + impl_->file_size);
+}
+
+Result<std::size_t> DirectFileReader::size() const {
+    return impl_->file_size;
+}
+
+Result<Bytes> DirectFileReader::read_range(std::size_t offset, std::size_t length) {
+    auto view = read_view(offset, length);
+    if (!view) {
+        return view.error();
+    }
+    return Bytes(view.value().begin(), view.value().end());
+}
+
+Result<std::span<const Byte>> DirectFileReader::read_view(std::size_t offset, std::size_t length) {
+    if (offset > impl_->file_size || length > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read range out of bounds"};
+    }
+    return std::span<const Byte>(data() + offset, length);
+}
+
+const Byte* DirectFileReader::data() const {
+    return impl_->data.get();
+}
+
+// pushes what was written to path down to the disk
+static Result<void> sync_file(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot open file: " + path};
+    }
+    int synced = fsync(fd);
+    ::close(fd);
+    if (synced < 0) {
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot sync file: " + path};
+    }
+#else
+    static_cast<void>(path);
+#endif
+    return Result<void>{};
+}
+
+// evicts path from the page cache. dirty pages can't be dropped, so
+// anything just written is pushed to disk first
+static void drop_cached_pages(const std::string& path, bool written) {
+#ifdef POSIX_FADV_DONTNEED
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (written) {
+        fdatasync(fd);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+#else
+    static_cast<void>(path);
+    static_cast<void>(written);
+#endif
+}
+
+// drops its file from the page cache on every flush()
+class DropBehindFileWriter : public FileWriter {
+public:
+    DropBehindFileWriter(std::unique_ptr<FileWriter> inner, std::string path)
+        : inner_(std::move(inner)), path_(std::move(path)) {}
+    
+    Result<void> write(std::span<const Byte> data) override {
+        return inner_->write(data);
+    }
+    
+    Result<void> write_at(std::size_t offset, std::span<const Byte> data) override {
+        return inner_->write_at(offset, data);
+    }
+    
+    Result<void> read_at(std::size_t offset, std::span<Byte> out) override {
+        return inner_->read_at(offset, out);
+    }
+    
+    Result<void> flush() override {
+        auto result = inner_->flush();
+        if (result) {
+            drop_cached_pages(path_, true);
+        }
+        return result;
+    }
+    
+    Result<void> close() override {
+        auto result = inner_->close();
+        if (result) {
+            drop_cached_pages(path_, true);
+        }
+        return result;
+    }
+    
+private:
+    std::unique_ptr<FileWriter> inner_;
+    std::string path_;
+};
+
 class BufferedFileWriter::Impl {
 public:
-    std::ofstream file;
+    // declared before file so it outlives the stream that writes through it
+    std::vector<char> stream_buffer;
+    // read/write so streaming appliers can read back what they wrote
+    std::fstream file;
     
-    static Result<std::unique_ptr<BufferedFileWriter>> create(const std::string& path) {
+    static Result<std::unique_ptr<BufferedFileWriter>> create(const std::string& path, std::size_t buffer_size,
+                                                             std::ios::openmode mode) {
         auto impl = std::make_unique<Impl>();
-        impl->file.open(path, std::ios::binary | std::ios::trunc);
+        if (buffer_size > 0) {
+            impl->stream_buffer.resize(buffer_size);
+            impl->file.rdbuf()->pubsetbuf(impl->stream_buffer.data(), impl->stream_buffer.size());
+        }
+        impl->file.open(path, std::ios::binary | std::ios::in | std::ios::out | mode);
         if (!impl->file) {
             return ErrorInfo{ErrorCode::FileWriteError, "Cannot create file: " + path};
         }
@@ -143,8 +449,12 @@ public:
 BufferedFileWriter::BufferedFileWriter() : impl_(std::make_unique<Impl>()) {}
 BufferedFileWriter::~BufferedFileWriter() = default;
 
-Result<std::unique_ptr<BufferedFileWriter>> BufferedFileWriter::create(const std::string& path) {
-    return Impl::create(path);
+Result<std::unique_ptr<BufferedFileWriter>> BufferedFileWriter::create(const std::string& path, std::size_t buffer_size) {
+    return Impl::create(path, buffer_size, std::ios::trunc);
+}
+
+Result<std::unique_ptr<BufferedFileWriter>> BufferedFileWriter::open_existing(const std::string& path, std::size_t buffer_size) {
+    return Impl::create(path, buffer_size, std::ios::openmode{});
 }
 
 Result<void> BufferedFileWriter::write(std::span<const Byte> data) {
@@ -159,11 +469,78 @@ Result<void> BufferedFileWriter::write_at(std::size_t offset, std::span<const By
     return write(data);
 }
 
+Result<void> BufferedFileWriter::read_at(std::size_t offset, std::span<Byte> out) {
+    // get and put share one position in a filebuf, put it back afterwards
+    auto put_pos = impl_->file.tellp();
+    impl_->file.seekg(offset);
+    impl_->file.read(reinterpret_cast<char*>(out.data()), out.size());
+    bool ok = static_cast<bool>(impl_->file);
+    impl_->file.clear();
+    impl_->file.seekp(put_pos);
+    if (!ok) {
+        return ErrorInfo{ErrorCode::FileReadError, "Read back failed"};
+    }
+    return Result<void>{};
+}
+
 Result<void> BufferedFileWriter::flush() {
-    impl_->file.flush();
+    // the buffered tail only hits the file here, so can fail here too
+    if (!impl_->file.flush()) {
+        return ErrorInfo{ErrorCode::FileWriteError, "Flush failed"};
+    }
     return Result<void>{};
 }
 
+Result<void> BufferedFileWriter::close() {
+    if (!impl_->file.is_open()) {
+        return Result<void>{};
+    }
+    // close() flushes first, either failing leaves the stream failed
+    impl_->file.close();
+    if (!impl_->file) {
+        return ErrorInfo{ErrorCode::FileWriteError, "Close failed"};
+    }
+    return Result<void>{};
+}
+
+Result<FileIdentity> get_file_identity(const std::string& path) {
+    FileIdentity id;
+#if defined(__unix__) || defined(__APPLE__)
+    struct stat st;
+    if (::stat(path.c_str(), &st) < 0) {
+        return ErrorInfo{ErrorCode::FileNotFound, "Cannot stat file: " + path};
+    }
+    id.device = static_cast<std::uint64_t>(st.st_dev);
+    id.inode = static_cast<std::uint64_t>(st.st_ino);
+    id.size = static_cast<std::uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    id.mtime_ns = static_cast<std::int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    id.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#elif defined(_WIN32)
+    HANDLE handle = CreateFileA(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return ErrorInfo{ErrorCode::FileNotFound, "Cannot open file: " + path};
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    BOOL ok = GetFileInformationByHandle(handle, &info);
+    CloseHandle(handle);
+    if (!ok) {
+        return ErrorInfo{ErrorCode::FileReadError, "Cannot stat file: " + path};
+    }
+    id.device = info.dwVolumeSerialNumber;
+    id.inode = (static_cast<std::uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    id.size = (static_cast<std::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    // FILETIME counts 100ns ticks
+    std::uint64_t ticks = (static_cast<std::uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+                          info.ftLastWriteTime.dwLowDateTime;
+    id.mtime_ns = static_cast<std::int64_t>(ticks) * 100;
+#endif
+    return id;
+}
+
 Result<std::unique_ptr<FileReader>> open_file_reader(const std::string& path, bool prefer_mmap) {
     #ifdef IUB_ENABLE_MMAP
     if (prefer_mmap) {
@@ -181,6 +558,66 @@ Result<std::unique_ptr<FileReader>> open_file_reader(const std::string& path, bo
     return std::unique_ptr<FileReader>(result.value().release());
 }
 
+#ifndef IUB_ENABLE_IO_URING
+bool io_uring_available() noexcept {
+    return false;
+}
+#endif
+
+Result<std::unique_ptr<FileReader>> open_file_reader(const std::string& path, const PatchOptions& options) {
+    if (options.cache_mode != PatchOptions::CacheMode::Normal) {
+        // a mapping would keep the pages cached for as long as it lives
+        if (options.cache_mode == PatchOptions::CacheMode::Direct) {
+            auto direct_result = DirectFileReader::open(path);
+            if (direct_result) {
+                return std::unique_ptr<FileReader>(direct_result.value().release());
+            }
+            if (direct_result.error().code != ErrorCode::NotSupported) {
+                return direct_result.error();
+            }
+        }
+        auto result = BufferedFileReader::open(path, options.io_buffer_size);
+        if (!result) {
+            return result.error();
+        }
+        drop_cached_pages(path, false);
+        return std::unique_ptr<FileReader>(result.value().release());
+    }
+    
+    #ifdef IUB_ENABLE_MMAP
+    if (options.use_mmap) {
+        // if stat fails here the buffered open below reports it
+        auto id_result = get_file_identity(path);
+        bool fits = id_result && (options.max_mmap_size == 0 || id_result.value().size <= options.max_mmap_size);
+        if (fits) {
+            bool huge_pages = options.mmap_huge_page_size > 0 && id_result.value().size >= options.mmap_huge_page_size;
+            auto mmap_result = MappedFileReader::open(path, options.mmap_populate, huge_pages);
+            if (mmap_result) {
+                return std::unique_ptr<FileReader>(mmap_result.value().release());
+            }
+        }
+    }
+    #endif
+    
+    #ifdef IUB_ENABLE_IO_URING
+    if (options.use_io_uring) {
+        // a mapping copies nothing, so this is for what can't be mapped.
+        // the reads are left in flight, read_view waits for just the range
+        // asked for and the caller can get on with something else meanwhile
+        auto uring_result = UringFileReader::open(path, options.io_buffer_size);
+        if (uring_result) {
+            return std::unique_ptr<FileReader>(uring_result.value().release());
+        }
+    }
+    #endif
+    
+    auto result = BufferedFileReader::open(path, options.io_buffer_size);
+    if (!result) {
+        return result.error();
+    }
+    return std::unique_ptr<FileReader>(result.value().release());
+}
+
 Result<std::unique_ptr<FileWriter>> create_file_writer(const std::string& path) {
     auto result = BufferedFileWriter::create(path);
     if (!result) {
@@ -189,12 +626,38 @@ Result<std::unique_ptr<FileWriter>> create_file_writer(const std::string& path)
     return std::unique_ptr<FileWriter>(result.value().release());
 }
 
+Result<std::unique_ptr<FileWriter>> create_file_writer(const std::string& path, const PatchOptions& options) {
+    std::unique_ptr<FileWriter> writer;
+    #ifdef IUB_ENABLE_IO_URING
+    if (options.use_io_uring) {
+        auto uring_result = UringFileWriter::create(path, options.io_buffer_size);
+        if (uring_result) {
+            writer = std::move(uring_result.value());
+        }
+    }
+    #endif
+    
+    if (!writer) {
+        auto result = BufferedFileWriter::create(path, options.io_buffer_size);
+        if (!result) {
+            return result.error();
+        }
+        writer = std::move(result.value());
+    }
+    
+    if (options.cache_mode != PatchOptions::CacheMode::Normal) {
+        writer = std::make_unique<DropBehindFileWriter>(std::move(writer), path);
+    }
+    return writer;
+}
+
 Result<Bytes> read_file(const std::string& path) {
-    auto reader_result = open_file_reader(path, false);
+    // the buffered reader already holds a fresh copy, hand that out
+    auto reader_result = BufferedFileReader::open(path);
     if (!reader_result) {
         return reader_result.error();
     }
-    return reader_result.value()->read_all();
+    return reader_result.value()->take_all();
 }
 
 Result<void> write_file(const std::string& path, std::span<const Byte> data) {
@@ -209,4 +672,258 @@ Result<void> write_file(const std::string& path, std::span<const Byte> data) {
     return writer_result.value()->flush();
 }
 
+Result<void> write_file(const std::string& path, std::span<const Byte> data, const PatchOptions& options) {
+    if (options.cache_mode == PatchOptions::CacheMode::Direct) {
+        auto direct_result = write_file_direct(path, data);
+        if (direct_result || direct_result.error().code != ErrorCode::NotSupported) {
+            return direct_result;
+        }
+    }
+    
+    auto writer_result = create_file_writer(path, options);
+    if (!writer_result) {
+        return writer_result.error();
+    }
+    auto write_result = writer_result.value()->write(data);
+    if (!write_result) {
+        return write_result;
+    }
+    return writer_result.value()->flush();
+}
+
+Result<void> fill_file(
+    const std::string& path,
+    std::size_t size,
+    const std::function<Result<void>(std::span<Byte>)>& fill,
+    const PatchOptions& options
+) {
+    #ifdef O_DIRECT
+    if (options.cache_mode == PatchOptions::CacheMode::Direct) {
+        // filled in a block aligned buffer that write_file can hand to
+        // O_DIRECT without copying
+        auto buffer = allocate_direct(size);
+        if (!buffer) {
+            return ErrorInfo{ErrorCode::OutOfMemory, "Cannot allocate output buffer for: " + path};
+        }
+        std::span<Byte> target(buffer.get(), size);
+        auto fill_result = fill(target);
+        if (!fill_result) {
+            return fill_result;
+        }
+        return write_file(path, std::span<const Byte>(target), options);
+    }
+    #endif
+    
+    #ifdef IUB_ENABLE_MMAP
+    bool wants_uring = options.use_io_uring && io_uring_available();
+    if (options.use_mmap && !wants_uring && (options.max_mmap_size == 0 || size <= options.max_mmap_size)) {
+        // filling a temp file keeps a failed fill from leaving half an
+        // output behind, and path may even be a source that is still mapped
+        std::string temp_path = path + ".partial";
+        std::error_code ec;
+        auto writer_result = MappedFileWriter::create(temp_path, size);
+        if (writer_result) {
+            auto& writer = writer_result.value();
+            auto fill_result = fill(std::span<Byte>(writer->data(), size));
+            if (fill_result) {
+                fill_result = writer->flush();
+            }
+            writer.reset();
+            
+            if (!fill_result) {
+                std::filesystem::remove(temp_path, ec);
+                return fill_result;
+            }
+            std::filesystem::rename(temp_path, path, ec);
+            if (ec) {
+                std::filesystem::remove(temp_path, ec);
+                return ErrorInfo{ErrorCode::FileWriteError, "Cannot replace file: " + path};
+            }
+            if (options.cache_mode != PatchOptions::CacheMode::Normal) {
+                drop_cached_pages(path, true);
+            }
+            return Result<void>{};
+        }
+        // e.g. a filesystem that can't be mapped, try the buffered way
+        std::filesystem::remove(temp_path, ec);
+    }
+    #endif
+    
+    Bytes buffer(size);
+    auto fill_result = fill(std::span<Byte>(buffer));
+    if (!fill_result) {
+        return fill_result;
+    }
+    return write_file(path, std::span<const Byte>(buffer), options);
+}
+
+const char* copy_method_to_string(CopyMethod method) {
+    switch (method) {
+        case CopyMethod::Clone: return "clone";
+        case CopyMethod::CopyFileRange: return "copy_file_range";
+        case CopyMethod::Buffered: return "buffered";
+    }
+    return "unknown";
+}
+
+Result<CopyMethod> clone_file(const std::string& src, const std::string& dst, CopyMethod first, CopyMethod last) {
+#if defined(__unix__) || defined(__APPLE__)
+    int in = ::open(src.c_str(), O_RDONLY);
+    if (in < 0) {
+        return ErrorInfo{ErrorCode::FileNotFound, "Cannot open file: " + src};
+    }
+    struct stat st;
+    if (fstat(in, &st) < 0) {
+        ::close(in);
+        return ErrorInfo{ErrorCode::FileReadError, "Cannot stat file: " + src};
+    }
+    
+#if defined(__APPLE__)
+    if (first == CopyMethod::Clone) {
+        // clonefile won't replace an existing file
+        ::unlink(dst.c_str());
+        if (clonefile(src.c_str(), dst.c_str(), 0) == 0) {
+            ::close(in);
+            return CopyMethod::Clone;
+        }
+    }
+#endif
+    
+    int out = ::open(dst.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (out < 0) {
+        ::close(in);
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot create file: " + dst};
+    }
+    fchmod(out, st.st_mode & 07777);
+    
+    CopyMethod method = CopyMethod::Buffered;
+    bool done = false;
+    auto give_up = [&]() -> Result<CopyMethod> {
+        ::close(in);
+        ::close(out);
+        ::unlink(dst.c_str());
+        return ErrorInfo{ErrorCode::NotSupported,
+            std::string("No ") + copy_method_to_string(last) + " copy of " + src + " to " + dst};
+    };
+#if defined(__linux__) && defined(FICLONE)
+    // btrfs, xfs, bcachefs... share the blocks, nothing is copied at all
+    if (first == CopyMethod::Clone && ioctl(out, FICLONE, in) == 0) {
+        method = CopyMethod::Clone;
+        done = true;
+    }
+#endif
+    if (!done && last == CopyMethod::Clone) {
+        return give_up();
+    }
+#if defined(__linux__)
+    if (!done && first != CopyMethod::Buffered) {
+        // still in the kernel, and server side on nfs/smb
+        auto remaining = static_cast<std::size_t>(st.st_size);
+        while (remaining > 0) {
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+            if (n <= 0) {
+                break;
+            }
+            remaining -= static_cast<std::size_t>(n);
+        }
+        if (remaining == 0) {
+            method = CopyMethod::CopyFileRange;
+            done = true;
+        }
+    }
+#endif
+    if (!done && last == CopyMethod::CopyFileRange) {
+        return give_up();
+    }
+    
+    bool ok = true;
+    if (!done) {
+        // start over in case copy_file_range gave up halfway
+        ok = lseek(in, 0, SEEK_SET) == 0 && lseek(out, 0, SEEK_SET) == 0 && ftruncate(out, 0) == 0;
+        std::vector<Byte> buffer(1 << 16);
+        while (ok) {
+            ssize_t n = ::read(in, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                ok = n == 0;
+                break;
+            }
+            for (ssize_t written = 0; ok && written < n;) {
+                ssize_t w = ::write(out, buffer.data() + written, static_cast<std::size_t>(n - written));
+                if (w < 0 && errno == EINTR) {
+                    continue;
+                }
+                ok = w > 0;
+                written += w;
+            }
+        }
+    }
+    
+    ::close(in);
+    if (::close(out) < 0) {
+        ok = false;
+    }
+    if (!ok) {
+        ::unlink(dst.c_str());
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot copy " + src + " to " + dst};
+    }
+    return method;
+#else
+    (void)first;
+    if (last != CopyMethod::Buffered) {
+        return ErrorInfo{ErrorCode::NotSupported,
+            std::string("No ") + copy_method_to_string(last) + " copy of " + src + " to " + dst};
+    }
+    std::error_code ec;
+    std::filesystem::copy_file(src, dst, std::filesystem::copy_options::overwrite_existing, ec);
+    if (ec) {
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot copy " + src + " to " + dst + ": " + ec.message()};
+    }
+    return CopyMethod::Buffered;
+#endif
+}
+
+Result<void> edit_file_copy(
+    const std::string& path,
+    const std::function<Result<void>(FileWriter&)>& edit,
+    const PatchOptions& options,
+    CopyMethod last
+) {
+    std::string temp_path = path + ".tmp";
+    auto clone_result = clone_file(path, temp_path, CopyMethod::Clone, last);
+    if (!clone_result) {
+        return clone_result.error();
+    }
+    
+    std::error_code ec;
+    auto writer_result = BufferedFileWriter::open_existing(temp_path, options.io_buffer_size);
+    if (!writer_result) {
+        std::filesystem::remove(temp_path, ec);
+        return writer_result.error();
+    }
+    
+    auto result = edit(*writer_result.value());
+    if (result) {
+        result = writer_result.value()->close();
+    }
+    writer_result.value().reset();
+    
+    // on disk before it replaces path, a crash can't leave a short file
+    if (result) {
+        result = sync_file(temp_path);
+    }
+    if (result) {
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec) {
+            result = ErrorInfo{ErrorCode::FileWriteError, "Cannot replace file: " + path};
+        }
+    }
+    if (!result) {
+        std::filesystem::remove(temp_path, ec);
+    }
+    return result;
+}
+
 } // namespace iubpatch
@@ -2,7 +2,9 @@
 #include "iubpatch/formats/ips.h"
 #include "iubpatch/formats/ups.h"
 #include "iubpatch/formats/bps.h"
+#include "formats/patch_file.h"
 #include <algorithm>
+#include <filesystem>
 
 namespace iubpatch {
 
@@ -11,7 +13,26 @@ static constexpr std::uint8_t IPS_MAGIC[] = {'P', 'A', 'T', 'C', 'H'};
 static constexpr std::uint8_t UPS_MAGIC[] = {'U', 'P', 'S', '1'};
 static constexpr std::uint8_t BPS_MAGIC[] = {'B', 'P', 'S', '1'};
 
-Result<Format> detect_format_from_memory(const Bytes& patch_data) {
+Result<void> Patch::apply_in_place(const std::string& file_path, const PatchOptions& options) const {
+    std::string temp_path = file_path + ".tmp";
+    auto result = apply_to_file(file_path, temp_path, options);
+    if (!result) {
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        return result;
+    }
+    
+    try {
+        std::filesystem::rename(temp_path, file_path);
+    } catch (const std::filesystem::filesystem_error& e) {
+        return ErrorInfo{ErrorCode::FileWriteError, 
+            "Failed to replace original file: " + std::string(e.what())};
+    }
+    
+    return Result<void>{};
+}
+
+Result<Format> detect_format_from_memory(std::span<const Byte> patch_data) {
     if (patch_data.size() < 4) {
         return ErrorInfo{ErrorCode::InvalidPatchFormat, "Patch data too small"};
     }
@@ -37,6 +58,10 @@ Result<Format> detect_format_from_memory(const Bytes& patch_data) {
     return ErrorInfo{ErrorCode::InvalidPatchFormat, "Unknown patch format"};
 }
 
+Result<Format> detect_format_from_memory(const Bytes& patch_data) {
+    return detect_format_from_memory(std::span<const Byte>(patch_data));
+}
+
 Result<Format> detect_format(const std::string& patch_path) {
     auto data_result = read_file(patch_path);
     if (!data_result) {
@@ -45,7 +70,7 @@ Result<Format> detect_format(const std::string& patch_path) {
     return detect_format_from_memory(data_result.value());
 }
 
-Result<std::unique_ptr<Patch>> load_patch_from_memory(const Bytes& patch_data) {
+Result<std::unique_ptr<Patch>> load_patch_from_memory(std::span<const Byte> patch_data, std::shared_ptr<const void> owner) {
     auto format_result = detect_format_from_memory(patch_data);
     if (!format_result) {
         return format_result.error();
@@ -55,21 +80,21 @@ Result<std::unique_ptr<Patch>> load_patch_from_memory(const Bytes& patch_data) {
     
     switch (format) {
         case Format::IPS: {
-            auto ips_result = IPSPatch::load(patch_data);
+            auto ips_result = IPSPatch::load(patch_data, std::move(owner));
             if (!ips_result) {
                 return ips_result.error();
             }
             return std::unique_ptr<Patch>(ips_result.value().release());
         }
         case Format::UPS: {
-            auto ups_result = UPSPatch::load(patch_data);
+            auto ups_result = UPSPatch::load(patch_data, std::move(owner));
             if (!ups_result) {
                 return ups_result.error();
             }
             return std::unique_ptr<Patch>(ups_result.value().release());
         }
         case Format::BPS: {
-            auto bps_result = BPSPatch::load(patch_data);
+            auto bps_result = BPSPatch::load(patch_data, std::move(owner));
             if (!bps_result) {
                 return bps_result.error();
             }
@@ -80,12 +105,40 @@ Result<std::unique_ptr<Patch>> load_patch_from_memory(const Bytes& patch_data) {
     }
 }
 
-Result<std::unique_ptr<Patch>> load_patch(const std::string& patch_path) {
-    auto data_result = read_file(patch_path);
-    if (!data_result) {
-        return data_result.error();
+Result<std::unique_ptr<Patch>> load_patch_from_memory(const Bytes& patch_data) {
+    auto owned = std::make_shared<const Bytes>(patch_data);
+    return load_patch_from_memory(std::span<const Byte>(*owned), owned);
+}
+
+namespace detail {
+
+Result<PatchFileView> open_patch_file(const std::string& path, const PatchOptions& options) {
+    auto reader_result = open_file_reader(path, options);
+    if (!reader_result) {
+        return reader_result.error();
+    }
+    std::shared_ptr<FileReader> reader = std::move(reader_result.value());
+    
+    auto size_result = reader->size();
+    if (!size_result) {
+        return size_result.error();
+    }
+    
+    auto view = reader->read_view(0, size_result.value());
+    if (!view) {
+        return view.error();
+    }
+    return PatchFileView{view.value(), std::move(reader)};
+}
+
+} // namespace detail
+
+Result<std::unique_ptr<Patch>> load_patch(const std::string& patch_path, const PatchOptions& options) {
+    auto file = detail::open_patch_file(patch_path, options);
+    if (!file) {
+        return file.error();
     }
-    return load_patch_from_memory(data_result.value());
+    return load_patch_from_memory(file.value().data, std::move(file.value().owner));
 }
 
 const char* format_to_string(Format format) noexcept {
@@ -0,0 +1,648 @@
+#include "iubpatch/io.h"
+
+#ifdef IUB_ENABLE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+
+namespace iubpatch {
+
+namespace {
+
+// no liburing dependency, the three syscalls are all we need
+int sys_io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+unsigned load_acquire(const unsigned* p) {
+    return std::atomic_ref<const unsigned>(*p).load(std::memory_order_acquire);
+}
+
+void store_release(unsigned* p, unsigned value) {
+    std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+}
+
+// one submission and one completion queue shared with the kernel. at most
+// capacity() ops are in flight so the completion queue can never overflow
+class Ring {
+public:
+    struct Completion {
+        std::uint64_t user_data;
+        std::int32_t res;
+    };
+
+    // failure is what a failed submit is reported as, a read or a write
+    // error depending on who owns the ring
+    static Result<std::unique_ptr<Ring>> create(unsigned entries, ErrorCode failure) {
+        auto ring = std::unique_ptr<Ring>(new Ring());
+        ring->failure_ = failure;
+
+        io_uring_params params{};
+        ring->fd_ = sys_io_uring_setup(entries, &params);
+        if (ring->fd_ < 0) {
+            return ErrorInfo{ErrorCode::NotSupported, std::string("io_uring_setup failed: ") + std::strerror(errno)};
+        }
+        ring->entries_ = params.sq_entries;
+
+        ring->sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            ring->sq_size_ = ring->cq_size_ = std::max(ring->sq_size_, ring->cq_size_);
+        }
+
+        ring->sq_ptr_ = mmap(nullptr, ring->sq_size_, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQ_RING);
+        if (ring->sq_ptr_ == MAP_FAILED) {
+            return ErrorInfo{ErrorCode::MmapFailed, "Cannot map io_uring submission queue"};
+        }
+        if (single_mmap) {
+            ring->cq_ptr_ = ring->sq_ptr_;
+        } else {
+            ring->cq_ptr_ = mmap(nullptr, ring->cq_size_, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_CQ_RING);
+            if (ring->cq_ptr_ == MAP_FAILED) {
+                return ErrorInfo{ErrorCode::MmapFailed, "Cannot map io_uring completion queue"};
+            }
+        }
+        ring->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return ErrorInfo{ErrorCode::MmapFailed, "Cannot map io_uring submission entries"};
+        }
+        ring->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        auto* sq = static_cast<char*>(ring->sq_ptr_);
+        ring->sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        ring->sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        ring->sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        ring->sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto* cq = static_cast<char*>(ring->cq_ptr_);
+        ring->cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        ring->cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        ring->cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        ring->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return ring;
+    }
+
+    ~Ring() {
+        if (sqes_) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != MAP_FAILED) {
+            munmap(sq_ptr_, sq_size_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    // pins the buffers so READ_FIXED/WRITE_FIXED skip mapping them per op
+    bool register_buffers(const iovec* buffers, unsigned count) {
+        return sys_io_uring_register(fd_, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+    }
+
+    unsigned capacity() const noexcept { return entries_; }
+
+    unsigned in_flight() const noexcept { return in_flight_; }
+
+    // buf_index < 0 for ops on unregistered memory. false when full
+    bool queue(std::uint8_t opcode, int fd, void* addr, std::uint32_t len, std::uint64_t offset,
+               std::uint64_t user_data, int buf_index = -1) {
+        if (in_flight_ >= entries_) {
+            return false;
+        }
+
+        // we are the only producer, so our own tail needs no barrier
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & sq_mask_;
+        io_uring_sqe& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<std::uint64_t>(addr);
+        sqe.len = len;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        if (buf_index >= 0) {
+            sqe.buf_index = static_cast<std::uint16_t>(buf_index);
+        }
+        sq_array_[index] = index;
+        store_release(sq_tail_, tail + 1);
+
+        ++pending_submit_;
+        ++in_flight_;
+        return true;
+    }
+
+    // hands everything queued to the kernel, optionally waiting for one
+    // completion to arrive
+    Result<void> submit(bool wait) {
+        if (pending_submit_ == 0 && !wait) {
+            return Result<void>{};
+        }
+        while (true) {
+            int ret = sys_io_uring_enter(fd_, pending_submit_, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+            if (ret >= 0) {
+                pending_submit_ -= std::min<unsigned>(pending_submit_, static_cast<unsigned>(ret));
+                return Result<void>{};
+            }
+            if (errno != EINTR && errno != EAGAIN) {
+                return ErrorInfo{failure_, std::string("io_uring_enter failed: ") + std::strerror(errno)};
+            }
+        }
+    }
+
+    std::optional<Completion> pop() {
+        unsigned head = *cq_head_;
+        if (head == load_acquire(cq_tail_)) {
+            return std::nullopt;
+        }
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        Completion completion{cqe.user_data, cqe.res};
+        store_release(cq_head_, head + 1);
+        --in_flight_;
+        return completion;
+    }
+
+    // next completion, waiting for it if needed
+    Result<Completion> wait() {
+        while (true) {
+            if (auto completion = pop()) {
+                return *completion;
+            }
+            auto result = submit(true);
+            if (!result) {
+                return result.error();
+            }
+        }
+    }
+
+private:
+    Ring() = default;
+
+    int fd_ = -1;
+    ErrorCode failure_ = ErrorCode::FileReadError;
+    unsigned entries_ = 0;
+    unsigned pending_submit_ = 0;
+    unsigned in_flight_ = 0;
+
+    void* sq_ptr_ = MAP_FAILED;
+    void* cq_ptr_ = MAP_FAILED;
+    io_uring_sqe* sqes_ = nullptr;
+    std::size_t sq_size_ = 0;
+    std::size_t cq_size_ = 0;
+    std::size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+constexpr unsigned RING_ENTRIES = 16;
+constexpr std::size_t MIN_CHUNK_SIZE = 4096;
+constexpr std::size_t MAX_CHUNK_SIZE = std::size_t{1} << 30;
+
+} // namespace
+
+bool io_uring_available() noexcept {
+    // containers commonly block the syscalls even on new kernels
+    static const bool available = [] {
+        io_uring_params params{};
+        int fd = sys_io_uring_setup(2, &params);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        return true;
+    }();
+    return available;
+}
+
+class UringFileReader::Impl {
+public:
+    int fd = -1;
+    Bytes data;
+    std::unique_ptr<Ring> ring;
+    bool fixed = false;
+    std::size_t chunk_size = 0;
+
+    // chunks are queued in order, filled[i] counts what has landed of chunk i
+    std::vector<std::size_t> filled;
+    std::size_t next_chunk = 0;
+    std::size_t contiguous = 0;
+    std::optional<ErrorInfo> error;
+
+    ~Impl() {
+        // the kernel may still be writing into data
+        while (ring && ring->in_flight() > 0 && ring->wait()) {}
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    std::size_t chunk_length(std::size_t chunk) const {
+        return std::min(chunk_size, data.size() - chunk * chunk_size);
+    }
+
+    bool queue_read(std::size_t chunk) {
+        std::size_t offset = chunk * chunk_size + filled[chunk];
+        auto length = static_cast<std::uint32_t>(chunk_length(chunk) - filled[chunk]);
+        if (fixed) {
+            return ring->queue(IORING_OP_READ_FIXED, fd, data.data() + offset, length, offset, chunk, 0);
+        }
+        return ring->queue(IORING_OP_READ, fd, data.data() + offset, length, offset, chunk);
+    }
+
+    Result<void> pump() {
+        while (next_chunk < filled.size() && queue_read(next_chunk)) {
+            ++next_chunk;
+        }
+        return ring->submit(false);
+    }
+
+    // blocks until chunks [0, until) have all landed
+    Result<void> wait_until(std::size_t until) {
+        while (!error && !complete(until)) {
+            auto pumped = pump();
+            if (!pumped) {
+                error = pumped.error();
+                break;
+            }
+            auto completion = ring->wait();
+            if (!completion) {
+                error = completion.error();
+                break;
+            }
+
+            std::size_t chunk = completion.value().user_data;
+            std::int32_t res = completion.value().res;
+            if (res < 0) {
+                error = ErrorInfo{ErrorCode::FileReadError, std::string("Read failed: ") + std::strerror(-res)};
+            } else if (res == 0) {
+                error = ErrorInfo{ErrorCode::FileReadError, "File shrank while being read"};
+            } else {
+                filled[chunk] += static_cast<std::size_t>(res);
+                if (filled[chunk] < chunk_length(chunk)) {
+                    // short read, the rest of the chunk goes back on the queue.
+                    // the completion we just took made room for it
+                    queue_read(chunk);
+                }
+            }
+        }
+        if (error) {
+            return *error;
+        }
+        return Result<void>{};
+    }
+
+    // chunks land out of order, only the leading run of complete ones counts
+    bool complete(std::size_t until) {
+        while (contiguous < filled.size() && filled[contiguous] == chunk_length(contiguous)) {
+            ++contiguous;
+        }
+        return contiguous >= until;
+    }
+    
+    Result<void> wait_range(std::size_t offset, std::size_t length) {
+        if (length == 0) {
+            return Result<void>{};
+        }
+        return wait_until((offset + length + chunk_size - 1) / chunk_size);
+    }
+};
+
+UringFileReader::UringFileReader() : impl_(nullptr) {}
+UringFileReader::~UringFileReader() = default;
+
+Result<std::unique_ptr<UringFileReader>> UringFileReader::open(const std::string& path, std::size_t chunk_size) {
+    if (!io_uring_available()) {
+        return ErrorInfo{ErrorCode::NotSupported, "io_uring is not available"};
+    }
+
+    auto impl = std::make_unique<UringFileReader::Impl>();
+    impl->fd = ::open(path.c_str(), O_RDONLY);
+    if (impl->fd < 0) {
+        return ErrorInfo{ErrorCode::FileNotFound, "Cannot open file: " + path};
+    }
+
+    struct stat st;
+    if (fstat(impl->fd, &st) < 0) {
+        return ErrorInfo{ErrorCode::FileReadError, "Cannot stat file: " + path};
+    }
+    impl->data.resize(static_cast<std::size_t>(st.st_size));
+    impl->chunk_size = std::clamp(chunk_size, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+
+    if (!impl->data.empty()) {
+        auto ring_result = Ring::create(RING_ENTRIES, ErrorCode::FileReadError);
+        if (!ring_result) {
+            return ring_result.error();
+        }
+        impl->ring = std::move(ring_result.value());
+
+        // a fixed buffer is capped at 1GB and by RLIMIT_MEMLOCK on older
+        // kernels, plain reads work for anything that doesn't register
+        iovec buffer{impl->data.data(), impl->data.size()};
+        impl->fixed = impl->ring->register_buffers(&buffer, 1);
+
+        impl->filled.assign((impl->data.size() + impl->chunk_size - 1) / impl->chunk_size, 0);
+        auto pumped = impl->pump();
+        if (!pumped) {
+            return pumped.error();
+        }
+    }
+
+    auto reader = std::unique_ptr<UringFileReader>(new UringFileReader());
+    reader->impl_ = std::move(impl);
+    return reader;
+}
+
+Result<void> UringFileReader::wait() {
+    return impl_->wait_until(impl_->filled.size());
+}
+
+Result<Bytes> UringFileReader::read_all() {
+    auto result = wait();
+    if (!result) {
+        return result.error();
+    }
+    return impl_->data;
+}
+
+Result<std::size_t> UringFileReader::size() const {
+    return impl_->data.size();
+}
+
+Result<Bytes> UringFileReader::read_range(std::size_t offset, std::size_t length) {
+    if (offset > impl_->data.size() || length > impl_->data.size() - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read range out of bounds"};
+    }
+    // only waits for the chunks covering the range
+    auto result = impl_->wait_range(offset, length);
+    if (!result) {
+        return result.error();
+    }
+    return Bytes(impl_->data.begin() + offset, impl_->data.begin() + offset + length);
+}
+
+Result<std::span<const Byte>> UringFileReader::read_view(std::size_t offset, std::size_t length) {
+    if (offset > impl_->data.size() || length > impl_->data.size() - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read range out of bounds"};
+    }
+    auto result = impl_->wait_range(offset, length);
+    if (!result) {
+        return result.error();
+    }
+    return std::span<const Byte>(impl_->data.data() + offset, length);
+}
+
+const Byte* UringFileReader::data() const {
+    if (!impl_->wait_until(impl_->filled.size())) {
+        return nullptr;
+    }
+    return impl_->data.data();
+}
+
+class UringFileWriter::Impl {
+public:
+    int fd = -1;
+    std::size_t slot_size = 0;
+    Bytes staging;
+    std::unique_ptr<Ring> ring;
+    bool fixed = false;
+
+    // each slot is one write in flight, tracked until all of it landed
+    struct Slot {
+        std::size_t offset = 0;
+        std::size_t length = 0;
+        std::size_t done = 0;
+        bool busy = false;
+    };
+    std::vector<Slot> slots;
+    std::vector<unsigned> free_slots;
+    std::size_t position = 0;
+    std::optional<ErrorInfo> error;
+
+    ~Impl() {
+        // the kernel may still be reading out of staging
+        while (ring && ring->in_flight() > 0 && ring->wait()) {}
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    void queue_write(unsigned slot) {
+        Slot& s = slots[slot];
+        Byte* addr = staging.data() + slot * slot_size + s.done;
+        auto length = static_cast<std::uint32_t>(s.length - s.done);
+        if (fixed) {
+            ring->queue(IORING_OP_WRITE_FIXED, fd, addr, length, s.offset + s.done, slot, static_cast<int>(slot));
+        } else {
+            ring->queue(IORING_OP_WRITE, fd, addr, length, s.offset + s.done, slot);
+        }
+    }
+
+    // takes one completion, a slot is freed once its whole write is done
+    void reap() {
+        auto submitted = ring->submit(false);
+        if (!submitted) {
+            error = submitted.error();
+            return;
+        }
+        auto completion = ring->wait();
+        if (!completion) {
+            error = completion.error();
+            return;
+        }
+
+        auto slot = static_cast<unsigned>(completion.value().user_data);
+        std::int32_t res = completion.value().res;
+        if (res <= 0) {
+            if (!error) {
+                error = ErrorInfo{ErrorCode::FileWriteError,
+                    std::string("Write failed: ") + (res < 0 ? std::strerror(-res) : "no progress")};
+            }
+            slots[slot].busy = false;
+            free_slots.push_back(slot);
+            return;
+        }
+        slots[slot].done += static_cast<std::size_t>(res);
+        if (slots[slot].done < slots[slot].length) {
+            queue_write(slot);
+        } else {
+            slots[slot].busy = false;
+            free_slots.push_back(slot);
+        }
+    }
+    
+    // queued writes complete in any order, so one over the same bytes as
+    // a write still in flight has to wait for it or the older data could
+    // land last
+    bool overlaps_in_flight(std::size_t offset, std::size_t length) const {
+        for (const Slot& s : slots) {
+            if (s.busy && s.offset < offset + length && offset < s.offset + s.length) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Result<void> drain() {
+        while (ring->in_flight() > 0) {
+            unsigned before = ring->in_flight();
+            reap();
+            if (ring->in_flight() == before) {
+                // the ring itself failed, nothing more will complete
+                break;
+            }
+        }
+        if (error) {
+            return *error;
+        }
+        return Result<void>{};
+    }
+};
+
+UringFileWriter::UringFileWriter() : impl_(nullptr) {}
+UringFileWriter::~UringFileWriter() = default;
+
+Result<std::unique_ptr<UringFileWriter>> UringFileWriter::create(const std::string& path, std::size_t slot_size) {
+    if (!io_uring_available()) {
+        return ErrorInfo{ErrorCode::NotSupported, "io_uring is not available"};
+    }
+
+    auto impl = std::make_unique<UringFileWriter::Impl>();
+    impl->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (impl->fd < 0) {
+        return ErrorInfo{ErrorCode::FileWriteError, "Cannot create file: " + path};
+    }
+
+    auto ring_result = Ring::create(RING_ENTRIES, ErrorCode::FileWriteError);
+    if (!ring_result) {
+        return ring_result.error();
+    }
+    impl->ring = std::move(ring_result.value());
+
+    // one staging slot per ring entry, each registered as its own buffer
+    unsigned slot_count = impl->ring->capacity();
+    impl->slot_size = std::clamp(slot_size, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    impl->staging.resize(slot_count * impl->slot_size);
+    impl->slots.resize(slot_count);
+    std::vector<iovec> buffers(slot_count);
+    for (unsigned i = 0; i < slot_count; ++i) {
+        buffers[i] = iovec{impl->staging.data() + i * impl->slot_size, impl->slot_size};
+        impl->free_slots.push_back(slot_count - 1 - i);
+    }
+    impl->fixed = impl->ring->register_buffers(buffers.data(), slot_count);
+
+    auto writer = std::unique_ptr<UringFileWriter>(new UringFileWriter());
+    writer->impl_ = std::move(impl);
+    return writer;
+}
+
+Result<void> UringFileWriter::write(std::span<const Byte> data) {
+    return write_at(impl_->position, data);
+}
+
+Result<void> UringFileWriter::write_at(std::size_t offset, std::span<const Byte> data) {
+    auto& impl = *impl_;
+    while (!data.empty() && !impl.error) {
+        if (impl.free_slots.empty()) {
+            impl.reap();
+            continue;
+        }
+        std::size_t n = std::min(data.size(), impl.slot_size);
+        if (impl.overlaps_in_flight(offset, n)) {
+            impl.reap();
+            continue;
+        }
+        unsigned slot = impl.free_slots.back();
+        impl.free_slots.pop_back();
+
+        std::memcpy(impl.staging.data() + slot * impl.slot_size, data.data(), n);
+        impl.slots[slot] = {offset, n, 0, true};
+        impl.queue_write(slot);
+
+        offset += n;
+        data = data.subspan(n);
+    }
+    impl.position = offset;
+
+    if (impl.error) {
+        return *impl.error;
+    }
+    // in flight from here on, the caller carries on while the kernel writes
+    auto submitted = impl.ring->submit(false);
+    if (!submitted) {
+        impl.error = submitted.error();
+    }
+    return submitted;
+}
+
+Result<void> UringFileWriter::read_at(std::size_t offset, std::span<Byte> out) {
+    auto drained = impl_->drain();
+    if (!drained) {
+        return drained;
+    }
+    while (!out.empty()) {
+        ssize_t n = pread(impl_->fd, out.data(), out.size(), static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return ErrorInfo{ErrorCode::FileReadError, "Read back failed"};
+        }
+        offset += static_cast<std::size_t>(n);
+        out = out.subspan(static_cast<std::size_t>(n));
+    }
+    return Result<void>{};
+}
+
+Result<void> UringFileWriter::flush() {
+    return impl_->drain();
+}
+
+Result<void> UringFileWriter::close() {
+    auto drained = impl_->drain();
+    if (impl_->fd >= 0) {
+        int closed = ::close(impl_->fd);
+        impl_->fd = -1;
+        if (closed < 0 && drained) {
+            return ErrorInfo{ErrorCode::FileWriteError, std::string("Close failed: ") + std::strerror(errno)};
+        }
+    }
+    return drained;
+}
+
+} // namespace iubpatch
+
+#endif // IUB_ENABLE_IO_URING
@@ -6,6 +6,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
 
 namespace iubpatch {
 
@@ -25,7 +28,7 @@ public:
         }
     }
     
-    static Result<std::unique_ptr<Impl>> open(const std::string& path) {
+    static Result<std::unique_ptr<Impl>> open(const std::string& path, bool populate, bool huge_pages) {
         auto impl = std::make_unique<Impl>();
         
         impl->fd = ::open(path.c_str(), O_RDONLY);
@@ -40,26 +43,63 @@ public:
         impl->file_size = st.st_size;
         
         if (impl->file_size > 0) {
+            int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+            if (populate) {
+                flags |= MAP_POPULATE;
+            }
+#else
+            static_cast<void>(populate);
+#endif
             impl->mapped_data = mmap(nullptr, impl->file_size, PROT_READ, 
-                                     MAP_PRIVATE, impl->fd, 0);
+                                     flags, impl->fd, 0);
             if (impl->mapped_data == MAP_FAILED) {
                 return ErrorInfo{ErrorCode::MmapFailed, "Memory mapping failed: " + path};
             }
             
             madvise(impl->mapped_data, impl->file_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            // file backed THP needs kernel support, without it this fails
+            // and the mapping keeps small pages
+            if (huge_pages) {
+                madvise(impl->mapped_data, impl->file_size, MADV_HUGEPAGE);
+            }
+#else
+            static_cast<void>(huge_pages);
+#endif
         }
         
         return impl;
     }
+    
+    void advise(std::size_t offset, std::size_t length, AccessHint hint) {
+        if (!mapped_data || offset >= file_size || length == 0) {
+            return;
+        }
+        length = std::min(length, file_size - offset);
+        
+        // madvise wants a page aligned start
+        static const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::size_t start = offset - offset % page_size;
+        
+        int advice = MADV_NORMAL;
+        switch (hint) {
+            case AccessHint::Normal: advice = MADV_NORMAL; break;
+            case AccessHint::Sequential: advice = MADV_SEQUENTIAL; break;
+            case AccessHint::Random: advice = MADV_RANDOM; break;
+            case AccessHint::WillNeed: advice = MADV_WILLNEED; break;
+        }
+        madvise(static_cast<Byte*>(mapped_data) + start, offset + length - start, advice);
+    }
 };
 
 MappedFileReader::MappedFileReader() : impl_(nullptr) {}
 MappedFileReader::~MappedFileReader() = default;
 
 
-Result<std::unique_ptr<MappedFileReader>> MappedFileReader::open(const std::string& path) {
+Result<std::unique_ptr<MappedFileReader>> MappedFileReader::open(const std::string& path, bool populate, bool huge_pages) {
     #ifdef IUB_ENABLE_MMAP
-        auto impl_result = Impl::open(path);
+        auto impl_result = Impl::open(path, populate, huge_pages);
         if (!impl_result) {
             return impl_result.error();
         }
@@ -73,7 +113,8 @@ Result<std::unique_ptr<MappedFileReader>> MappedFileReader::open(const std::stri
 }
 
 Result<Bytes> MappedFileReader::read_all() {
-    if (!impl_ || !impl_->mapped_data) {
+    // an empty file has nothing to map and reads back as empty
+    if (!impl_ || (!impl_->mapped_data && impl_->file_size > 0)) {
         return ErrorInfo{ErrorCode::MmapFailed, "No mapped data"};
     }
     Bytes result(static_cast<const Byte*>(impl_->mapped_data),
@@ -89,7 +130,7 @@ Result<std::size_t> MappedFileReader::size() const {
 }
 
 Result<Bytes> MappedFileReader::read_range(std::size_t offset, std::size_t length) {
-    if (!impl_ || !impl_->mapped_data) {
+    if (!impl_ || (!impl_->mapped_data && impl_->file_size > 0)) {
         return ErrorInfo{ErrorCode::MmapFailed, "No mapped data"};
     }
     if (offset + length > impl_->file_size) {
@@ -100,10 +141,138 @@ Result<Bytes> MappedFileReader::read_range(std::size_t offset, std::size_t lengt
     return result;
 }
 
+Result<std::span<const Byte>> MappedFileReader::read_view(std::size_t offset, std::size_t length) {
+    if (!impl_ || (!impl_->mapped_data && impl_->file_size > 0)) {
+        return ErrorInfo{ErrorCode::MmapFailed, "No mapped data"};
+    }
+    if (offset > impl_->file_size || length > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read range out of bounds"};
+    }
+    return std::span<const Byte>(static_cast<const Byte*>(impl_->mapped_data) + offset, length);
+}
+
 const Byte* MappedFileReader::data() const {
     return impl_ ? static_cast<const Byte*>(impl_->mapped_data) : nullptr;
 }
 
+void MappedFileReader::advise(std::size_t offset, std::size_t length, AccessHint hint) {
+    if (impl_) {
+        impl_->advise(offset, length, hint);
+    }
+}
+
+// POSIX implementation of MappedFileWriter::Impl
+class MappedFileWriter::Impl {
+public:
+    int fd = -1;
+    void* mapped_data = nullptr;
+    std::size_t file_size = 0;
+    std::size_t position = 0;
+    
+    ~Impl() {
+        if (mapped_data && mapped_data != MAP_FAILED) {
+            munmap(mapped_data, file_size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    
+    static Result<std::unique_ptr<Impl>> create(const std::string& path, std::size_t size) {
+        auto impl = std::make_unique<Impl>();
+        
+        impl->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (impl->fd < 0) {
+            return ErrorInfo{ErrorCode::FileWriteError, "Cannot create file: " + path};
+        }
+        
+        if (ftruncate(impl->fd, static_cast<off_t>(size)) < 0) {
+            return ErrorInfo{ErrorCode::FileWriteError, "Cannot size file: " + path};
+        }
+        impl->file_size = size;
+        
+        if (size > 0) {
+#if defined(__linux__)
+            // reserve the blocks now, a full disk then fails here instead of
+            // as a SIGBUS halfway through writing the mapping
+            int err = posix_fallocate(impl->fd, 0, static_cast<off_t>(size));
+            if (err != 0 && err != EOPNOTSUPP && err != EINVAL) {
+                return ErrorInfo{ErrorCode::FileWriteError,
+                    "Cannot allocate file: " + path + ": " + std::strerror(err)};
+            }
+#endif
+            impl->mapped_data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED, impl->fd, 0);
+            if (impl->mapped_data == MAP_FAILED) {
+                return ErrorInfo{ErrorCode::MmapFailed, "Memory mapping failed: " + path};
+            }
+        }
+        
+        return impl;
+    }
+};
+
+MappedFileWriter::MappedFileWriter() : impl_(nullptr) {}
+MappedFileWriter::~MappedFileWriter() = default;
+
+Result<std::unique_ptr<MappedFileWriter>> MappedFileWriter::create(const std::string& path, std::size_t size) {
+    #ifdef IUB_ENABLE_MMAP
+        auto impl_result = Impl::create(path, size);
+        if (!impl_result) {
+            return impl_result.error();
+        }
+        
+        auto writer = std::unique_ptr<MappedFileWriter>(new MappedFileWriter());
+        writer->impl_ = std::move(impl_result.value());
+        return writer;
+    #else
+        return ErrorInfo{ErrorCode::MmapFailed, "Memory mapping disabled"};
+    #endif
+}
+
+Result<void> MappedFileWriter::write(std::span<const Byte> data) {
+    auto result = write_at(impl_->position, data);
+    if (result) {
+        impl_->position += data.size();
+    }
+    return result;
+}
+
+Result<void> MappedFileWriter::write_at(std::size_t offset, std::span<const Byte> data) {
+    if (offset > impl_->file_size || data.size() > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Write past the end of the mapping"};
+    }
+    if (!data.empty()) {
+        std::memcpy(static_cast<Byte*>(impl_->mapped_data) + offset, data.data(), data.size());
+    }
+    return Result<void>{};
+}
+
+Result<void> MappedFileWriter::read_at(std::size_t offset, std::span<Byte> out) {
+    if (offset > impl_->file_size || out.size() > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read past the end of the mapping"};
+    }
+    if (!out.empty()) {
+        std::memcpy(out.data(), static_cast<const Byte*>(impl_->mapped_data) + offset, out.size());
+    }
+    return Result<void>{};
+}
+
+Result<void> MappedFileWriter::flush() {
+    if (impl_->mapped_data && msync(impl_->mapped_data, impl_->file_size, MS_ASYNC) < 0) {
+        return ErrorInfo{ErrorCode::FileWriteError, "msync failed"};
+    }
+    return Result<void>{};
+}
+
+Byte* MappedFileWriter::data() {
+    return static_cast<Byte*>(impl_->mapped_data);
+}
+
+std::size_t MappedFileWriter::size() const noexcept {
+    return impl_->file_size;
+}
+
 } // namespace iubpatch
 
 #endif // defined(__unix__) || defined(__APPLE__)
@@ -4,6 +4,7 @@
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <cstring>
 
 namespace iubpatch {
 
@@ -82,7 +83,8 @@ public:
 MappedFileReader::MappedFileReader() : impl_(nullptr) {}
 MappedFileReader::~MappedFileReader() = default;
 
-Result<std::unique_ptr<MappedFileReader>> MappedFileReader::open(const std::string& path) {
+// populate and huge_pages have no cheap equivalent for file views here
+Result<std::unique_ptr<MappedFileReader>> MappedFileReader::open(const std::string& path, bool, bool) {
     #ifdef IUB_ENABLE_MMAP
         auto impl_result = Impl::open(path);
         if (!impl_result) {
@@ -98,7 +100,8 @@ Result<std::unique_ptr<MappedFileReader>> MappedFileReader::open(const std::stri
 }
 
 Result<Bytes> MappedFileReader::read_all() {
-    if (!impl_ || !impl_->mapped_data) {
+    // an empty file has nothing to map and reads back as empty
+    if (!impl_ || (!impl_->mapped_data && impl_->file_size > 0)) {
         return ErrorInfo{ErrorCode::MmapFailed, "No mapped data"};
     }
     Bytes result(static_cast<const Byte*>(impl_->mapped_data),
@@ -114,7 +117,7 @@ Result<std::size_t> MappedFileReader::size() const {
 }
 
 Result<Bytes> MappedFileReader::read_range(std::size_t offset, std::size_t length) {
-    if (!impl_ || !impl_->mapped_data) {
+    if (!impl_ || (!impl_->mapped_data && impl_->file_size > 0)) {
         return ErrorInfo{ErrorCode::MmapFailed, "No mapped data"};
     }
     if (offset + length > impl_->file_size) {
@@ -125,10 +128,170 @@ Result<Bytes> MappedFileReader::read_range(std::size_t offset, std::size_t lengt
     return result;
 }
 
+Result<std::span<const Byte>> MappedFileReader::read_view(std::size_t offset, std::size_t length) {
+    if (!impl_ || (!impl_->mapped_data && impl_->file_size > 0)) {
+        return ErrorInfo{ErrorCode::MmapFailed, "No mapped data"};
+    }
+    if (offset > impl_->file_size || length > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read range out of bounds"};
+    }
+    return std::span<const Byte>(static_cast<const Byte*>(impl_->mapped_data) + offset, length);
+}
+
 const Byte* MappedFileReader::data() const {
     return impl_ ? static_cast<const Byte*>(impl_->mapped_data) : nullptr;
 }
 
+void MappedFileReader::advise(std::size_t offset, std::size_t length, AccessHint hint) {
+    // only WillNeed maps onto something, the rest is left to the cache manager
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+    if (hint != AccessHint::WillNeed || !impl_ || !impl_->mapped_data || offset >= impl_->file_size) {
+        return;
+    }
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = static_cast<Byte*>(impl_->mapped_data) + offset;
+    range.NumberOfBytes = (length < impl_->file_size - offset) ? length : impl_->file_size - offset;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    static_cast<void>(offset);
+    static_cast<void>(length);
+    static_cast<void>(hint);
+#endif
+}
+
+// Windows implementation of MappedFileWriter::Impl, the mapping itself
+// grows the file to size
+class MappedFileWriter::Impl {
+public:
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+    void* mapped_data = nullptr;
+    std::size_t file_size = 0;
+    std::size_t position = 0;
+    
+    ~Impl() {
+        if (mapped_data) {
+            UnmapViewOfFile(mapped_data);
+        }
+        if (mapping_handle) {
+            CloseHandle(mapping_handle);
+        }
+        if (file_handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_handle);
+        }
+    }
+    
+    static Result<std::unique_ptr<Impl>> create(const std::string& path, std::size_t size) {
+        auto impl = std::make_unique<Impl>();
+        
+        impl->file_handle = CreateFileA(
+            path.c_str(),
+            GENERIC_READ | GENERIC_WRITE,
+            0,
+            nullptr,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr
+        );
+        
+        if (impl->file_handle == INVALID_HANDLE_VALUE) {
+            return ErrorInfo{ErrorCode::FileWriteError, "Cannot create file: " + path};
+        }
+        impl->file_size = size;
+        
+        // an empty file can't be mapped, and needs nothing written anyway
+        if (size > 0) {
+            ULARGE_INTEGER mapping_size;
+            mapping_size.QuadPart = size;
+            impl->mapping_handle = CreateFileMappingA(
+                impl->file_handle,
+                nullptr,
+                PAGE_READWRITE,
+                mapping_size.HighPart, mapping_size.LowPart,
+                nullptr
+            );
+            
+            if (!impl->mapping_handle) {
+                return ErrorInfo{ErrorCode::MmapFailed, "Cannot create file mapping: " + path};
+            }
+            
+            impl->mapped_data = MapViewOfFile(
+                impl->mapping_handle,
+                FILE_MAP_WRITE,
+                0, 0,
+                size
+            );
+            
+            if (!impl->mapped_data) {
+                return ErrorInfo{ErrorCode::MmapFailed, "Cannot map view of file: " + path};
+            }
+        }
+        
+        return impl;
+    }
+};
+
+MappedFileWriter::MappedFileWriter() : impl_(nullptr) {}
+MappedFileWriter::~MappedFileWriter() = default;
+
+Result<std::unique_ptr<MappedFileWriter>> MappedFileWriter::create(const std::string& path, std::size_t size) {
+    #ifdef IUB_ENABLE_MMAP
+        auto impl_result = Impl::create(path, size);
+        if (!impl_result) {
+            return impl_result.error();
+        }
+        
+        auto writer = std::unique_ptr<MappedFileWriter>(new MappedFileWriter());
+        writer->impl_ = std::move(impl_result.value());
+        return writer;
+    #else
+        return ErrorInfo{ErrorCode::MmapFailed, "Memory mapping disabled"};
+    #endif
+}
+
+Result<void> MappedFileWriter::write(std::span<const Byte> data) {
+    auto result = write_at(impl_->position, data);
+    if (result) {
+        impl_->position += data.size();
+    }
+    return result;
+}
+
+Result<void> MappedFileWriter::write_at(std::size_t offset, std::span<const Byte> data) {
+    if (offset > impl_->file_size || data.size() > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Write past the end of the mapping"};
+    }
+    if (!data.empty()) {
+        std::memcpy(static_cast<Byte*>(impl_->mapped_data) + offset, data.data(), data.size());
+    }
+    return Result<void>{};
+}
+
+Result<void> MappedFileWriter::read_at(std::size_t offset, std::span<Byte> out) {
+    if (offset > impl_->file_size || out.size() > impl_->file_size - offset) {
+        return ErrorInfo{ErrorCode::InvalidArgument, "Read past the end of the mapping"};
+    }
+    if (!out.empty()) {
+        std::memcpy(out.data(), static_cast<const Byte*>(impl_->mapped_data) + offset, out.size());
+    }
+    return Result<void>{};
+}
+
+Result<void> MappedFileWriter::flush() {
+    if (impl_->mapped_data && !FlushViewOfFile(impl_->mapped_data, 0)) {
+        return ErrorInfo{ErrorCode::FileWriteError, "FlushViewOfFile failed"};
+    }
+    return Result<void>{};
+}
+
+Byte* MappedFileWriter::data() {
+    return static_cast<Byte*>(impl_->mapped_data);
+}
+
+std::size_t MappedFileWriter::size() const noexcept {
+    return impl_->file_size;
+}
+
 } // namespace iubpatch
 
 #endif // _WIN32
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include "iubpatch/apply.h"
 #include "iubpatch/options.h"
+#include "iubpatch/checksum_cache.h"
+#include "iubpatch/crc32.h"
 #include <fstream>
 #include <filesystem>
 
@@ -35,9 +37,12 @@ TEST_F(ApplyTest, CreateBackup) {
     PatchOptions opts;
     opts.create_backup = true;
     
-    auto backup_path = create_backup(source, opts);
+    CopyMethod method;
+    auto backup_path = create_backup(source, opts, &method);
     ASSERT_TRUE(backup_path.is_ok());
     EXPECT_TRUE(fs::exists(backup_path.value()));
+    EXPECT_STRNE(copy_method_to_string(method), "unknown");
+    EXPECT_EQ(read_file(backup_path.value()).value(), read_file(source.string()).value());
 }
 
 TEST_F(ApplyTest, VerifyOutput) {
@@ -121,3 +126,101 @@ TEST_F(ApplyTest, ValidatePatchChecksumMismatch) {
     result = validate_patch(patch_path.string(), source_path.string(), opts);
     EXPECT_TRUE(result.is_ok()) << "Validation failed for correct file: " << (result.is_ok() ? "" : result.error().message);
 }
+
+TEST_F(ApplyTest, ChecksumCache) {
+    auto source = test_dir / "source.bin";
+    auto cache_path = (test_dir / "crc.cache").string();
+    create_test_file(source, "test");
+
+    PatchOptions opts;
+    opts.use_checksum_cache = true;
+    opts.checksum_cache_path = cache_path.c_str();
+
+    auto crc = file_crc32(source.string(), opts);
+    ASSERT_TRUE(crc.is_ok());
+    EXPECT_EQ(crc.value(), 0xD87F7E0Cu);
+
+    // the first call hashed the file and recorded it
+    auto id = get_file_identity(source.string());
+    ASSERT_TRUE(id.is_ok());
+    ChecksumCache cache(cache_path);
+    auto cached = cache.lookup(id.value());
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_EQ(*cached, 0xD87F7E0Cu);
+
+    // a changed file has a different identity and gets hashed again
+    create_test_file(source, "test data");
+    crc = file_crc32(source.string(), opts);
+    ASSERT_TRUE(crc.is_ok());
+    std::string data = "test data";
+    EXPECT_EQ(crc.value(), calc_crc32(std::vector<Byte>(data.begin(), data.end())));
+    EXPECT_EQ(cached_file_crc32(source.string(), opts), crc.value());
+
+    // the appliers' side: nothing is stored for a file that changed after
+    // it was read, and nothing is served when the options don't ask for it
+    auto before = get_file_identity(source.string()).value();
+    create_test_file(source, "other data");
+    store_file_crc32(source.string(), before, 0x12345678u, opts);
+    EXPECT_FALSE(cached_file_crc32(source.string(), opts).has_value());
+    store_file_crc32(source.string(), get_file_identity(source.string()).value(), 0x12345678u, opts);
+    EXPECT_EQ(cached_file_crc32(source.string(), opts), 0x12345678u);
+    opts.use_checksum_cache = false;
+    EXPECT_FALSE(cached_file_crc32(source.string(), opts).has_value());
+}
+
+TEST_F(ApplyTest, LoadPatchFromFile) {
+    auto patch_path = test_dir / "test.ips";
+    create_test_file(patch_path, std::string("PATCH\x00\x00\x01\x00\x02xy", 12) + "EOF");
+
+    auto patch_result = load_patch(patch_path.string());
+    ASSERT_TRUE(patch_result.is_ok()) << patch_result.error().message;
+
+    // the patch holds on to the file's reader, not the path
+    std::error_code ec;
+    fs::remove(patch_path, ec);
+
+    std::vector<Byte> source = {'a', 'b', 'c', 'd'};
+    auto result = patch_result.value()->apply(source);
+    ASSERT_TRUE(result.is_ok());
+    EXPECT_EQ(result.value(), (std::vector<Byte>{'a', 'x', 'y', 'd'}));
+}
+
+TEST_F(ApplyTest, ApplyPatchWritesOutput) {
+    auto patch_path = test_dir / "test.ips";
+    auto source_path = test_dir / "source.bin";
+    auto output_path = test_dir / "output.bin";
+    // one record inside the source and one growing it
+    create_test_file(patch_path, std::string("PATCH\x00\x00\x01\x00\x02xy\x00\x00\x05\x00\x01z", 18) + "EOF");
+    create_test_file(source_path, "abcd");
+
+    // io_uring quietly falls back where it isn't built or allowed
+    for (int mode : {0, 1, 2}) {
+        PatchOptions opts;
+        opts.use_mmap = mode == 0;
+        opts.use_io_uring = mode == 2;
+        auto result = apply_patch(patch_path.string(), source_path.string(), output_path.string(), opts);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+
+        std::ifstream ifs(output_path, std::ios::binary);
+        std::string output((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(output, std::string("axyd\0z", 6)) << "mode=" << mode;
+        EXPECT_FALSE(fs::exists(output_path.string() + ".partial"));
+    }
+}
+
+TEST_F(ApplyTest, EmptySourceWithDefaultOptions) {
+    // an empty file has nothing to map, it still reads back as empty
+    auto source = test_dir / "empty.bin";
+    auto patch_path = test_dir / "grow.ips";
+    auto output = test_dir / "out.bin";
+    create_test_file(source, "");
+    create_test_file(patch_path, std::string("PATCH\x00\x00\x00\x00\x02xy", 12) + "EOF");
+
+    auto crc = file_crc32(source.string());
+    ASSERT_TRUE(crc.is_ok()) << crc.error().message;
+    EXPECT_EQ(crc.value(), 0u);
+
+    auto result = apply_patch(patch_path.string(), source.string(), output.string());
+    ASSERT_TRUE(result.is_ok()) << result.error().message;
+    EXPECT_EQ(read_file(output.string()).value(), (std::vector<Byte>{'x', 'y'}));
+}
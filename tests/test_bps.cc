@@ -1,9 +1,63 @@
 #include <gtest/gtest.h>
 #include "iubpatch/formats/bps.h"
+#include "iubpatch/crc32.h"
+#include "test_util.h"
 #include <vector>
+#include <string>
+#include <filesystem>
 
 using namespace iubpatch;
 
+namespace {
+
+void encode_num(std::vector<Byte>& out, std::uint64_t value) {
+    while (true) {
+        Byte x = value & 0x7F;
+        value >>= 7;
+        if (value == 0) {
+            out.push_back(0x80 | x);
+            break;
+        }
+        out.push_back(x);
+        value--;
+    }
+}
+
+void append_crc(std::vector<Byte>& out, std::uint32_t crc) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<Byte>(crc >> (8 * i)));
+    }
+}
+
+std::vector<Byte> bytes(const std::string& s) {
+    return std::vector<Byte>(s.begin(), s.end());
+}
+
+// patch exercising all four commands, including an overlapping TargetCopy
+std::vector<Byte> make_patch(const std::vector<Byte>& source, const std::vector<Byte>& target) {
+    std::vector<Byte> patch = {'B', 'P', 'S', '1'};
+    encode_num(patch, source.size());
+    encode_num(patch, target.size());
+    encode_num(patch, 0);
+
+    encode_num(patch, ((3 - 1) << 2) | 0);      // SourceRead 3 "ABC"
+    encode_num(patch, ((3 - 1) << 2) | 1);      // TargetRead 3 "xyz"
+    patch.insert(patch.end(), {'x', 'y', 'z'});
+    encode_num(patch, ((2 - 1) << 2) | 2);      // SourceCopy 2 from +7 "HI"
+    encode_num(patch, 7 << 1);
+    encode_num(patch, ((5 - 1) << 2) | 3);      // TargetCopy 5 from +3 "xyzHI"
+    encode_num(patch, 3 << 1);
+    encode_num(patch, ((4 - 1) << 2) | 3);      // TargetCopy 4 from +4 "IIII"
+    encode_num(patch, 4 << 1);
+
+    append_crc(patch, calc_crc32(source));
+    append_crc(patch, calc_crc32(target));
+    append_crc(patch, calc_crc32(patch));
+    return patch;
+}
+
+} // namespace
+
 TEST(BPSTest, DetectFormat) {
     // BPS magic: "BPS1" + minimal valid patch
     std::vector<Byte> valid_bps = {
@@ -26,3 +80,305 @@ TEST(BPSTest, InvalidMagic) {
     auto patch_result = BPSPatch::load(invalid);
     EXPECT_FALSE(patch_result.is_ok());
 }
+
+TEST(BPSTest, ApplyAllCommands) {
+    auto source = bytes("ABCDEFGHIJ");
+    auto target = bytes("ABCxyzHIxyzHIIIII");
+    auto patch_data = make_patch(source, target);
+
+    auto patch_result = BPSPatch::load(patch_data);
+    ASSERT_TRUE(patch_result.is_ok()) << patch_result.error().message;
+    auto& patch = patch_result.value();
+    EXPECT_TRUE(patch->validate().is_ok());
+
+    for (unsigned threads : {1u, 4u}) {
+        PatchOptions options;
+        options.checksum_threads = threads;
+        auto result = patch->apply(source, options);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+        EXPECT_EQ(result.value(), target);
+    }
+}
+
+TEST(BPSTest, ApplyWrongSourceChecksum) {
+    auto source = bytes("ABCDEFGHIJ");
+    auto patch = BPSPatch::load(make_patch(source, bytes("ABCxyzHIxyzHIIIII"))).value();
+
+    for (unsigned threads : {1u, 4u}) {
+        PatchOptions options;
+        options.checksum_threads = threads;
+        auto result = patch->apply(bytes("ABCDEFGHIK"), options);
+        ASSERT_FALSE(result.is_ok());
+        EXPECT_EQ(result.error().code, ErrorCode::ChecksumMismatch);
+    }
+}
+
+TEST(BPSTest, LoadVerifiesPatchChecksum) {
+    auto patch_data = make_patch(bytes("ABCDEFGHIJ"), bytes("ABCxyzHIxyzHIIIII"));
+    EXPECT_TRUE(BPSPatch::load(patch_data, true).is_ok());
+
+    // flip a payload byte, parsing alone still succeeds
+    patch_data[9] ^= 0x01;
+    EXPECT_TRUE(BPSPatch::load(patch_data).is_ok());
+
+    auto result = BPSPatch::load(patch_data, true);
+    ASSERT_FALSE(result.is_ok());
+    EXPECT_EQ(result.error().code, ErrorCode::ChecksumMismatch);
+}
+
+TEST(BPSTest, ApplyStreamingSmallWindow) {
+    auto source = bytes("ABCDEFGHIJ");
+    auto target = bytes("ABCxyzHIxyzHIIIII");
+    auto patch = BPSPatch::load(make_patch(source, target)).value();
+    auto output_path = (std::filesystem::temp_directory_path() / "iubpatch_bps_stream.bin").string();
+
+    // tiny windows force TargetCopy to read back from the file
+    for (std::size_t window : {1u, 3u, 8u, 64u}) {
+        PatchOptions options;
+        options.stream_window_size = window;
+        {
+            auto writer = BufferedFileWriter::create(output_path).value();
+            auto result = patch->apply_streaming(source, *writer, options);
+            ASSERT_TRUE(result.is_ok()) << result.error().message;
+            ASSERT_TRUE(writer->flush().is_ok());
+        }
+        auto written = read_file(output_path);
+        ASSERT_TRUE(written.is_ok());
+        EXPECT_EQ(written.value(), target) << "window=" << window;
+    }
+    std::filesystem::remove(output_path);
+}
+
+TEST(BPSTest, TargetCopyPeriodsAndLengths) {
+    // TargetCopy with every mix of repeat period and length the bulk copy
+    // handles differently, checked against a byte at a time copy
+    std::vector<Byte> source;
+    std::vector<Byte> target;
+    std::vector<Byte> commands;
+    for (int i = 0; i < 100; ++i) {
+        target.push_back(static_cast<Byte>(i * 37 + 11));
+    }
+    encode_num(commands, ((100 - 1) << 2) | 1);     // TargetRead 100
+    commands.insert(commands.end(), target.begin(), target.end());
+
+    std::size_t target_rel = 0;
+    const std::pair<std::size_t, std::size_t> copies[] = {
+        {1, 1}, {1, 5000}, {3, 100000}, {7, 5}, {100, 99}, {100, 100}, {100, 101},
+        {64, 200000}, {65536, 70000}, {65537, 140000}, {1000, 1000}, {250000, 3},
+    };
+    for (auto [distance, length] : copies) {
+        std::size_t from = target.size() - distance;
+        for (std::size_t i = 0; i < length; ++i) {
+            target.push_back(target[from + i]);
+        }
+        encode_num(commands, ((length - 1) << 2) | 3);
+        std::int64_t delta = static_cast<std::int64_t>(from) - static_cast<std::int64_t>(target_rel);
+        encode_num(commands, delta < 0 ? (static_cast<std::uint64_t>(-delta) << 1) | 1 : static_cast<std::uint64_t>(delta) << 1);
+        target_rel = from + length;
+    }
+
+    std::vector<Byte> patch_data = {'B', 'P', 'S', '1'};
+    encode_num(patch_data, source.size());
+    encode_num(patch_data, target.size());
+    encode_num(patch_data, 0);
+    patch_data.insert(patch_data.end(), commands.begin(), commands.end());
+    append_crc(patch_data, calc_crc32(source));
+    append_crc(patch_data, calc_crc32(target));
+    append_crc(patch_data, calc_crc32(patch_data));
+    auto patch = BPSPatch::load(patch_data).value();
+
+    auto result = patch->apply(source);
+    ASSERT_TRUE(result.is_ok()) << result.error().message;
+    EXPECT_TRUE(result.value() == target);
+
+    auto output_path = (std::filesystem::temp_directory_path() / "iubpatch_bps_targetcopy.bin").string();
+    for (std::size_t window : {4096u, 1u << 20}) {
+        PatchOptions options;
+        options.stream_window_size = window;
+        {
+            auto writer = BufferedFileWriter::create(output_path).value();
+            auto streamed = patch->apply_streaming(source, *writer, options);
+            ASSERT_TRUE(streamed.is_ok()) << streamed.error().message;
+            ASSERT_TRUE(writer->flush().is_ok());
+        }
+        EXPECT_TRUE(read_file(output_path).value() == target) << "window=" << window;
+    }
+    std::filesystem::remove(output_path);
+}
+
+TEST(BPSTest, ApplyScatteredSourceCopyToFile) {
+    // big enough for the source to get access hints, with jumps sparse
+    // enough for it to be advised Random
+    std::vector<Byte> source(8 << 20);
+    for (std::size_t i = 0; i < source.size(); ++i) {
+        source[i] = static_cast<Byte>(i * 131 + (i >> 12));
+    }
+
+    std::vector<Byte> target;
+    std::vector<Byte> commands;
+    std::size_t rel_offset = 0;
+    std::uint32_t seed = 1;
+    for (int i = 0; i < 256; ++i) {
+        seed = seed * 1103515245 + 12345;
+        std::size_t offset = (seed >> 8) % (source.size() - 64);
+        std::int64_t delta = static_cast<std::int64_t>(offset) - static_cast<std::int64_t>(rel_offset);
+        encode_num(commands, ((64 - 1) << 2) | 2);
+        encode_num(commands, delta < 0 ? ((-delta) << 1) | 1 : delta << 1);
+        target.insert(target.end(), source.begin() + offset, source.begin() + offset + 64);
+        rel_offset = offset + 64;
+    }
+
+    std::vector<Byte> patch_data = {'B', 'P', 'S', '1'};
+    encode_num(patch_data, source.size());
+    encode_num(patch_data, target.size());
+    encode_num(patch_data, 0);
+    patch_data.insert(patch_data.end(), commands.begin(), commands.end());
+    append_crc(patch_data, calc_crc32(source));
+    append_crc(patch_data, calc_crc32(target));
+    append_crc(patch_data, calc_crc32(patch_data));
+    auto patch = BPSPatch::load(patch_data).value();
+
+    auto dir = std::filesystem::temp_directory_path();
+    auto source_path = (dir / "iubpatch_bps_scatter_src.bin").string();
+    auto output_path = (dir / "iubpatch_bps_scatter_out.bin").string();
+    ASSERT_TRUE(write_file(source_path, source).is_ok());
+
+    for (bool hints : {false, true}) {
+        PatchOptions options;
+        options.access_hints = hints;
+        options.mmap_populate = !hints;
+        options.mmap_huge_page_size = 1 << 20;
+        auto result = patch->apply_to_file(source_path, output_path, options);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+        EXPECT_EQ(read_file(output_path).value(), target) << "hints=" << hints;
+    }
+    std::filesystem::remove(source_path);
+    std::filesystem::remove(output_path);
+}
+
+TEST(BPSTest, TruncatedTargetReadFailsOnApply) {
+    auto source = bytes("ABCDEFGHIJ");
+    std::vector<Byte> patch_data = {'B', 'P', 'S', '1'};
+    encode_num(patch_data, source.size());
+    encode_num(patch_data, 20);
+    encode_num(patch_data, 0);
+    encode_num(patch_data, ((20 - 1) << 2) | 1);    // TargetRead 20, only 2 bytes follow
+    patch_data.insert(patch_data.end(), {'x', 'y'});
+    append_crc(patch_data, calc_crc32(source));
+    append_crc(patch_data, 0);
+    append_crc(patch_data, calc_crc32(patch_data));
+
+    // commands are only decoded when applying
+    auto patch = BPSPatch::load(patch_data, true);
+    ASSERT_TRUE(patch.is_ok());
+    auto result = patch.value()->apply(source);
+    ASSERT_FALSE(result.is_ok());
+    EXPECT_EQ(result.error().code, ErrorCode::InvalidPatchFormat);
+}
+
+TEST(BPSTest, HeaderNumbersOfEveryWidth) {
+    const std::uint64_t values[] = {0, 127, 128, 16511, 16512, 0x12345678, std::uint64_t{1} << 40,
+                                    std::uint64_t{1} << 56, ~std::uint64_t{0}};
+    for (std::uint64_t value : values) {
+        // with and without room for a whole word after the number
+        for (std::string metadata : {"", "padding for a word load"}) {
+            std::vector<Byte> patch_data = {'B', 'P', 'S', '1'};
+            encode_num(patch_data, value);
+            encode_num(patch_data, 0);
+            encode_num(patch_data, metadata.size());
+            patch_data.insert(patch_data.end(), metadata.begin(), metadata.end());
+            patch_data.insert(patch_data.end(), 12, 0);
+
+            auto patch = BPSPatch::load(patch_data);
+            ASSERT_TRUE(patch.is_ok()) << value << ": " << patch.error().message;
+            EXPECT_EQ(patch.value()->get_metadata().value().src_size, value);
+        }
+    }
+}
+
+TEST(BPSTest, MalformedNumbersFailCleanly) {
+    auto header_with = [](std::vector<Byte> number) {
+        std::vector<Byte> patch_data = {'B', 'P', 'S', '1'};
+        patch_data.insert(patch_data.end(), number.begin(), number.end());
+        encode_num(patch_data, 0);
+        encode_num(patch_data, 0);
+        patch_data.insert(patch_data.end(), 12, 0);
+        return patch_data;
+    };
+
+    // one past the largest value that fits, and a number that never ends
+    auto overflow = BPSPatch::load(header_with({0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x81}));
+    ASSERT_FALSE(overflow.is_ok());
+    EXPECT_EQ(overflow.error().code, ErrorCode::InvalidPatchFormat);
+    auto endless = BPSPatch::load(header_with(std::vector<Byte>(16, 0x00)));
+    ASSERT_FALSE(endless.is_ok());
+    EXPECT_EQ(endless.error().code, ErrorCode::InvalidPatchFormat);
+
+    // a number running into the checksums is truncated, not read from them
+    std::vector<Byte> truncated = {'B', 'P', 'S', '1', 0x00, 0x00};
+    truncated.insert(truncated.end(), 12, 0xFF);
+    EXPECT_FALSE(BPSPatch::load(truncated).is_ok());
+
+    // same for a command offset at the end of the stream
+    auto source = bytes("ABCDEFGHIJ");
+    std::vector<Byte> patch_data = {'B', 'P', 'S', '1'};
+    encode_num(patch_data, source.size());
+    encode_num(patch_data, 4);
+    encode_num(patch_data, 0);
+    encode_num(patch_data, ((4 - 1) << 2) | 2);     // SourceCopy 4, offset cut short
+    patch_data.push_back(0x00);
+    patch_data.insert(patch_data.end(), 12, 0xFF);
+    auto patch = BPSPatch::load(patch_data);
+    ASSERT_TRUE(patch.is_ok());
+    PatchOptions options;
+    options.verify_checksums = false;
+    auto result = patch.value()->apply(source, options);
+    ASSERT_FALSE(result.is_ok());
+    EXPECT_EQ(result.error().code, ErrorCode::InvalidPatchFormat);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST(BPSTest, StreamingWriteFailureKeepsOutput) {
+    auto source = bytes("ABCDEFGHIJ");
+    std::vector<Byte> target(9004);
+    for (std::size_t i = 0; i < target.size(); ++i) {
+        target[i] = static_cast<Byte>(i * 7 + 3);
+    }
+    std::vector<Byte> patch_data = {'B', 'P', 'S', '1'};
+    encode_num(patch_data, source.size());
+    encode_num(patch_data, target.size());
+    encode_num(patch_data, 0);
+    encode_num(patch_data, ((target.size() - 1) << 2) | 1);
+    patch_data.insert(patch_data.end(), target.begin(), target.end());
+    append_crc(patch_data, calc_crc32(source));
+    append_crc(patch_data, calc_crc32(target));
+    append_crc(patch_data, calc_crc32(patch_data));
+    auto patch = BPSPatch::load(patch_data).value();
+
+    auto dir = std::filesystem::temp_directory_path();
+    auto source_path = (dir / "iubpatch_bps_limit_src.bin").string();
+    auto output_path = (dir / "iubpatch_bps_limit_out.bin").string();
+    auto old_output = bytes("previous output");
+    ASSERT_TRUE(write_file(source_path, source).is_ok());
+    ASSERT_TRUE(write_file(output_path, old_output).is_ok());
+
+    // the target streams out through a small window and only the tail
+    // crosses the limit, when it is flushed on close
+    PatchOptions options;
+    options.stream_window_size = 1024;
+    Result<void> result;
+    {
+        FileSizeLimit limit(8192);
+        result = patch->apply_to_file(source_path, output_path, options);
+    }
+    EXPECT_FALSE(result.is_ok());
+    EXPECT_EQ(read_file(output_path).value(), old_output);
+    EXPECT_FALSE(std::filesystem::exists(output_path + ".partial"));
+
+    auto applied = patch->apply_to_file(source_path, output_path, options);
+    ASSERT_TRUE(applied.is_ok()) << applied.error().message;
+    EXPECT_EQ(read_file(output_path).value(), target);
+    std::filesystem::remove(source_path);
+    std::filesystem::remove(output_path);
+}
+#endif
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include "iubpatch/crc32.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+
+using namespace iubpatch;
+
+namespace {
+
+std::vector<std::uint8_t> make_data(std::size_t size) {
+    std::vector<std::uint8_t> data(size);
+    std::uint32_t x = 0x12345678;
+    for (auto& b : data) {
+        x = x * 1103515245 + 12345;
+        b = static_cast<std::uint8_t>(x >> 16);
+    }
+    return data;
+}
+
+} // namespace
+
+TEST(CRC32Test, KnownVectors) {
+    std::string check = "123456789";
+    std::vector<std::uint8_t> data(check.begin(), check.end());
+    EXPECT_EQ(calc_crc32(data), 0xCBF43926u);
+
+    std::vector<std::uint8_t> test = {'t', 'e', 's', 't'};
+    EXPECT_EQ(calc_crc32(test), 0xD87F7E0Cu);
+
+    EXPECT_EQ(calc_crc32(std::vector<std::uint8_t>{}), 0u);
+}
+
+TEST(CRC32Test, SlicingMatchesBytewise) {
+    auto data = make_data(4096 + 37);
+
+    // every length up to a few blocks plus some unaligned starts
+    for (std::size_t offset = 0; offset < 16; ++offset) {
+        for (std::size_t len = 0; len < 300; ++len) {
+            std::span<const std::uint8_t> view(data.data() + offset, len);
+            std::uint32_t expected = crc32_update_bytewise(0xFFFFFFFF, view);
+            EXPECT_EQ(crc32_update_slice8(0xFFFFFFFF, view), expected);
+            EXPECT_EQ(crc32_update_slice16(0xFFFFFFFF, view), expected);
+        }
+    }
+
+    std::uint32_t expected = crc32_update_bytewise(0xFFFFFFFF, data) ^ 0xFFFFFFFF;
+    EXPECT_EQ(calc_crc32(data), expected);
+}
+
+TEST(CRC32Test, DispatchedBackendMatchesBytewise) {
+    auto data = make_data(64 * 1024 + 123);
+
+    // cover the folding loop, the 16-byte tail fold and the byte remainder
+    for (std::size_t offset = 0; offset < 16; ++offset) {
+        for (std::size_t len : {0, 1, 15, 16, 63, 64, 65, 127, 128, 129, 200, 1000, 4097}) {
+            std::span<const std::uint8_t> view(data.data() + offset, len);
+            EXPECT_EQ(crc32_update(0x12345678, view), crc32_update_bytewise(0x12345678, view))
+                << crc32_backend_name() << " offset " << offset << " len " << len;
+        }
+    }
+
+    std::span<const std::uint8_t> all(data);
+    EXPECT_EQ(crc32_update(0xFFFFFFFF, all), crc32_update_bytewise(0xFFFFFFFF, all));
+}
+
+TEST(CRC32Test, IncrementalMatchesOneShot) {
+    auto data = make_data(10000);
+    std::uint32_t expected = calc_crc32(data);
+
+    for (std::size_t chunk : {1, 7, 64, 1000, 4096}) {
+        Crc32 crc;
+        for (std::size_t pos = 0; pos < data.size(); pos += chunk) {
+            std::size_t len = std::min(chunk, data.size() - pos);
+            crc.update({data.data() + pos, len});
+        }
+        EXPECT_EQ(crc.finalize(), expected) << "chunk " << chunk;
+        EXPECT_EQ(crc.size(), data.size());
+    }
+}
+
+TEST(CRC32Test, Combine) {
+    auto data = make_data(5000);
+    std::uint32_t expected = calc_crc32(data);
+    std::span<const std::uint8_t> all(data);
+
+    for (std::size_t split : {0, 1, 17, 2500, 4999, 5000}) {
+        auto a = all.first(split);
+        auto b = all.subspan(split);
+        EXPECT_EQ(crc32_combine(calc_crc32(a), calc_crc32(b), b.size()), expected)
+            << "split " << split;
+
+        Crc32 left, right;
+        left.update(a);
+        right.update(b);
+        left.combine(right);
+        EXPECT_EQ(left.finalize(), expected);
+        EXPECT_EQ(left.size(), data.size());
+    }
+}
+
+TEST(CRC32Test, ParallelMatchesSerial) {
+    // large enough that several threads actually get a share
+    auto data = make_data(8 * 1024 * 1024 + 11);
+    std::uint32_t expected = calc_crc32(data);
+
+    for (unsigned threads : {0u, 1u, 2u, 3u, 8u, 64u}) {
+        EXPECT_EQ(calc_crc32_parallel(data, threads), expected) << threads << " threads";
+    }
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "iubpatch/io.h"
+#include "test_util.h"
 #include <fstream>
 #include <filesystem>
 
@@ -39,6 +40,105 @@ TEST_F(IOTest, OpenFileReader) {
     EXPECT_EQ(reader->size().value(), 4);
 }
 
+TEST_F(IOTest, ReadViewAndTakeAll) {
+    auto test_file = test_dir / "view.bin";
+    std::vector<Byte> data = {0x01, 0x02, 0x03, 0x04, 0x05};
+    create_test_file(test_file, data);
+
+    for (bool mapped : {false, true}) {
+        auto reader = open_file_reader(test_file.string(), mapped);
+        ASSERT_TRUE(reader.is_ok());
+        auto view = reader.value()->read_view(1, 3);
+        ASSERT_TRUE(view.is_ok());
+        EXPECT_EQ(view.value().data(), reader.value()->data() + 1);
+        EXPECT_EQ(std::vector<Byte>(view.value().begin(), view.value().end()), (std::vector<Byte>{0x02, 0x03, 0x04}));
+        EXPECT_TRUE(reader.value()->read_view(5, 0).is_ok());
+        EXPECT_FALSE(reader.value()->read_view(4, 2).is_ok());
+        EXPECT_FALSE(reader.value()->read_view(6, 0).is_ok());
+    }
+
+    auto buffered = BufferedFileReader::open(test_file.string());
+    ASSERT_TRUE(buffered.is_ok());
+    const Byte* before = buffered.value()->data();
+    auto taken = buffered.value()->take_all();
+    EXPECT_EQ(taken, data);
+    EXPECT_EQ(taken.data(), before);
+    EXPECT_EQ(buffered.value()->size().value(), 0u);
+}
+
+#ifdef IUB_ENABLE_MMAP
+TEST_F(IOTest, MappedFileReaderAdvise) {
+    auto test_file = test_dir / "advise.bin";
+    std::vector<Byte> data(3 * 4096 + 5);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<Byte>(i * 7);
+    }
+    create_test_file(test_file, data);
+
+    auto reader = MappedFileReader::open(test_file.string(), true, true);
+    ASSERT_TRUE(reader.is_ok());
+    // unaligned, past the end and empty ranges are all fine
+    reader.value()->advise(0, data.size(), AccessHint::Random);
+    reader.value()->advise(4097, 10, AccessHint::WillNeed);
+    reader.value()->advise(4000, 1 << 20, AccessHint::Normal);
+    reader.value()->advise(data.size() + 1, 10, AccessHint::WillNeed);
+    reader.value()->advise(5, 0, AccessHint::Sequential);
+    EXPECT_EQ(reader.value()->read_all().value(), data);
+
+    // readers without a mapping take hints and ignore them
+    auto buffered = BufferedFileReader::open(test_file.string());
+    ASSERT_TRUE(buffered.is_ok());
+    buffered.value()->advise(0, data.size(), AccessHint::WillNeed);
+    EXPECT_EQ(buffered.value()->read_all().value(), data);
+}
+#endif
+
+TEST_F(IOTest, CacheModesRoundTrip) {
+    // not a multiple of the block size, so the last direct block is padded
+    std::vector<Byte> data(3 * 4096 + 123);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<Byte>(i * 13);
+    }
+
+    // tmpfs refuses O_DIRECT, which has to fall back quietly
+    std::vector<fs::path> dirs = {test_dir};
+    if (fs::is_directory("/dev/shm")) {
+        dirs.push_back("/dev/shm");
+    }
+    for (const auto& dir : dirs) {
+        for (auto mode : {PatchOptions::CacheMode::DropBehind, PatchOptions::CacheMode::Direct}) {
+            PatchOptions options;
+            options.cache_mode = mode;
+            auto path = (dir / "iubpatch_cache_mode.bin").string();
+
+            ASSERT_TRUE(write_file(path, data, options).is_ok());
+            auto reader = open_file_reader(path, options);
+            ASSERT_TRUE(reader.is_ok()) << reader.error().message;
+            EXPECT_FALSE(reader.value()->is_mapped());
+            EXPECT_EQ(reader.value()->read_all().value(), data);
+
+            auto fill_result = fill_file(path, data.size(), [&](std::span<Byte> target) {
+                std::copy(data.rbegin(), data.rend(), target.begin());
+                return Result<void>{};
+            }, options);
+            ASSERT_TRUE(fill_result.is_ok());
+            EXPECT_EQ(read_file(path).value(), std::vector<Byte>(data.rbegin(), data.rend()));
+
+            auto writer = create_file_writer(path, options);
+            ASSERT_TRUE(writer.is_ok());
+            ASSERT_TRUE(writer.value()->write(data).is_ok());
+            ASSERT_TRUE(writer.value()->flush().is_ok());
+            writer.value().reset();
+            EXPECT_EQ(read_file(path).value(), data);
+            fs::remove(path);
+        }
+    }
+
+    auto direct = DirectFileReader::open((test_dir / "missing.bin").string());
+    ASSERT_FALSE(direct.is_ok());
+    EXPECT_EQ(direct.error().code, ErrorCode::FileNotFound);
+}
+
 TEST_F(IOTest, CreateFileWriter) {
     auto test_file = test_dir / "output.bin";
     
@@ -51,3 +151,188 @@ TEST_F(IOTest, CreateFileWriter) {
     auto write_result = writer->write(data);
     EXPECT_TRUE(write_result.is_ok());
 }
+
+TEST_F(IOTest, OpenFileReaderHonorsOptions) {
+    auto test_file = test_dir / "test.bin";
+    std::vector<Byte> data = {0x01, 0x02, 0x03, 0x04};
+    create_test_file(test_file, data);
+
+    PatchOptions options;
+    options.use_mmap = false;
+    auto buffered = open_file_reader(test_file.string(), options);
+    ASSERT_TRUE(buffered.is_ok());
+    EXPECT_FALSE(buffered.value()->is_mapped());
+
+    // too big for the mmap limit, falls back to a buffered read
+    options.use_mmap = true;
+    options.max_mmap_size = 2;
+    auto limited = open_file_reader(test_file.string(), options);
+    ASSERT_TRUE(limited.is_ok());
+    EXPECT_FALSE(limited.value()->is_mapped());
+    EXPECT_EQ(std::vector<Byte>(limited.value()->data(), limited.value()->data() + 4), data);
+
+#ifdef IUB_ENABLE_MMAP
+    options.max_mmap_size = 0;
+    auto mapped = open_file_reader(test_file.string(), options);
+    ASSERT_TRUE(mapped.is_ok());
+    EXPECT_TRUE(mapped.value()->is_mapped());
+#endif
+
+#ifdef IUB_ENABLE_IO_URING
+    // io_uring only reads what isn't mapped, and hands the reader out with
+    // the reads still going
+    options.use_io_uring = true;
+#ifdef IUB_ENABLE_MMAP
+    EXPECT_TRUE(open_file_reader(test_file.string(), options).value()->is_mapped());
+#endif
+    options.use_mmap = false;
+    auto uring = open_file_reader(test_file.string(), options);
+    ASSERT_TRUE(uring.is_ok());
+    EXPECT_FALSE(uring.value()->is_mapped());
+    EXPECT_EQ(uring.value()->read_view(1, 2).value()[1], 0x03);
+    EXPECT_EQ(uring.value()->read_all().value(), data);
+#endif
+}
+
+#ifdef IUB_ENABLE_MMAP
+TEST_F(IOTest, MappedFileWriter) {
+    auto test_file = test_dir / "mapped.bin";
+
+    auto writer_result = MappedFileWriter::create(test_file.string(), 4);
+    ASSERT_TRUE(writer_result.is_ok());
+    auto writer = std::move(writer_result.value());
+    EXPECT_EQ(writer->size(), 4u);
+
+    std::vector<Byte> head = {0x01, 0x02};
+    EXPECT_TRUE(writer->write(head).is_ok());
+    writer->data()[2] = 0x03;
+    std::vector<Byte> tail = {0x04};
+    EXPECT_TRUE(writer->write_at(3, tail).is_ok());
+    // the file was sized up front and can't grow
+    EXPECT_FALSE(writer->write_at(4, tail).is_ok());
+    writer.reset();
+
+    auto reader = open_file_reader(test_file.string(), false);
+    ASSERT_TRUE(reader.is_ok());
+    EXPECT_EQ(reader.value()->read_all().value(), (std::vector<Byte>{0x01, 0x02, 0x03, 0x04}));
+}
+#endif
+
+#ifdef IUB_ENABLE_IO_URING
+TEST_F(IOTest, UringReaderWriterRoundTrip) {
+    if (!io_uring_available()) {
+        GTEST_SKIP() << "io_uring not available on this kernel";
+    }
+    auto test_file = test_dir / "uring.bin";
+
+    // several slots' worth, so writes queue up behind each other
+    std::vector<Byte> data(300000);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<Byte>(i * 31 + 7);
+    }
+
+    auto writer = UringFileWriter::create(test_file.string(), 4096);
+    ASSERT_TRUE(writer.is_ok()) << writer.error().message;
+    ASSERT_TRUE(writer.value()->write(data).is_ok());
+    std::vector<Byte> back(16);
+    ASSERT_TRUE(writer.value()->read_at(5000, back).is_ok());
+    EXPECT_EQ(back, std::vector<Byte>(data.begin() + 5000, data.begin() + 5016));
+    ASSERT_TRUE(writer.value()->flush().is_ok());
+    writer.value().reset();
+
+    auto reader = UringFileReader::open(test_file.string(), 4096);
+    ASSERT_TRUE(reader.is_ok()) << reader.error().message;
+    EXPECT_EQ(reader.value()->size().value(), data.size());
+    auto range = reader.value()->read_range(123456, 100);
+    ASSERT_TRUE(range.is_ok());
+    EXPECT_EQ(range.value(), std::vector<Byte>(data.begin() + 123456, data.begin() + 123556));
+    EXPECT_EQ(reader.value()->read_all().value(), data);
+}
+
+TEST_F(IOTest, UringWriterLaterWriteWins) {
+    if (!io_uring_available()) {
+        GTEST_SKIP() << "io_uring not available on this kernel";
+    }
+    auto test_file = test_dir / "uring_rewrite.bin";
+
+    // every range is written again while the first write may still be
+    // in flight, the second one has to be what ends up on disk
+    std::vector<Byte> first(200000, 0x11);
+    std::vector<Byte> second(200000);
+    for (std::size_t i = 0; i < second.size(); ++i) {
+        second[i] = static_cast<Byte>(i * 7 + 5);
+    }
+    std::vector<Byte> patch(3000, 0xEE);
+
+    auto writer = UringFileWriter::create(test_file.string(), 4096);
+    ASSERT_TRUE(writer.is_ok()) << writer.error().message;
+    for (int round = 0; round < 8; ++round) {
+        ASSERT_TRUE(writer.value()->write_at(0, first).is_ok());
+        ASSERT_TRUE(writer.value()->write_at(0, second).is_ok());
+        ASSERT_TRUE(writer.value()->write_at(5000, patch).is_ok());
+    }
+    ASSERT_TRUE(writer.value()->close().is_ok());
+    writer.value().reset();
+
+    std::copy(patch.begin(), patch.end(), second.begin() + 5000);
+    EXPECT_EQ(read_file(test_file.string()).value(), second);
+}
+#endif
+
+TEST_F(IOTest, CloneFileStrategies) {
+    auto src = test_dir / "src.bin";
+    std::vector<Byte> data(200000);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<Byte>(i * 13 + 1);
+    }
+    create_test_file(src, data);
+
+    // whatever the filesystem supports, the chain never goes cheaper than asked
+    for (auto first : {CopyMethod::Clone, CopyMethod::CopyFileRange, CopyMethod::Buffered}) {
+        auto dst = test_dir / "dst.bin";
+        create_test_file(dst, {0xFF});
+        auto result = clone_file(src.string(), dst.string(), first);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+        EXPECT_GE(static_cast<int>(result.value()), static_cast<int>(first))
+            << copy_method_to_string(result.value());
+        EXPECT_EQ(read_file(dst.string()).value(), data);
+    }
+
+    // nor dearer than allowed, giving up leaves nothing behind
+    auto dst = test_dir / "clone_only.bin";
+    auto result = clone_file(src.string(), dst.string(), CopyMethod::Clone, CopyMethod::Clone);
+    if (result) {
+        EXPECT_EQ(result.value(), CopyMethod::Clone);
+        EXPECT_EQ(read_file(dst.string()).value(), data);
+    } else {
+        EXPECT_EQ(result.error().code, ErrorCode::NotSupported);
+        EXPECT_FALSE(fs::exists(dst));
+    }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST_F(IOTest, EditFileCopyKeepsFileOnFailedWriteBack) {
+    auto path = test_dir / "edit.bin";
+    std::vector<Byte> data(4096, 0x11);
+    create_test_file(path, data);
+
+    // the second write sits in the stream buffer until the final flush,
+    // which is where the limit hits
+    const Byte first[] = {0xAA};
+    const Byte second[] = {0xBB};
+    Result<void> result;
+    {
+        FileSizeLimit limit(8192);
+        result = edit_file_copy(path.string(), [&](FileWriter& writer) -> Result<void> {
+            auto written = writer.write_at(0, first);
+            if (!written) {
+                return written;
+            }
+            return writer.write_at(9000, second);
+        }, PatchOptions{}, CopyMethod::Buffered);
+    }
+    EXPECT_FALSE(result.is_ok());
+    EXPECT_EQ(read_file(path.string()).value(), data);
+    EXPECT_FALSE(fs::exists(path.string() + ".tmp"));
+}
+#endif
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 #include "iubpatch/formats/ips.h"
+#include "iubpatch/io.h"
 #include <vector>
+#include <fstream>
+#include <filesystem>
 
 using namespace iubpatch;
 
@@ -33,3 +36,107 @@ TEST(IPSTest, ValidateFormat) {
     auto valid = patch->validate();
     EXPECT_TRUE(valid.is_ok());
 }
+
+TEST(IPSTest, ApplyFromSpan) {
+    std::vector<Byte> patch_data = {
+        'P', 'A', 'T', 'C', 'H',
+        0x00, 0x00, 0x02, 0x00, 0x02, 0xAA, 0xBB,   // 2 bytes at 2
+        0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x03, 0xCC,   // RLE 3 x 0xCC at 6
+        'E', 'O', 'F'
+    };
+    auto patch = IPSPatch::load(patch_data).value();
+
+    // source doesn't have to live in a vector
+    const Byte source[] = {0, 1, 2, 3, 4, 5, 6};
+    auto result = patch->apply(std::span<const Byte>(source));
+    ASSERT_TRUE(result.is_ok());
+    EXPECT_EQ(result.value(), (std::vector<Byte>{0, 1, 0xAA, 0xBB, 4, 5, 0xCC, 0xCC, 0xCC}));
+}
+
+TEST(IPSTest, ApplyInPlaceMatchesApply) {
+    std::vector<Byte> patch_data = {
+        'P', 'A', 'T', 'C', 'H',
+        0x00, 0x00, 0x01, 0x00, 0x01, 0xAA,   // inside the file
+        0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x02, 0xCC,   // RLE past the end, leaving a gap
+        0x00, 0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0xDD,   // empty RLE at 100, still grows the file
+        'E', 'O', 'F'
+    };
+    auto patch = IPSPatch::load(patch_data).value();
+    std::vector<Byte> source = {1, 2, 3, 4};
+    auto expected = patch->apply(source).value();
+    ASSERT_EQ(expected.size(), 100u);
+
+    auto path = (std::filesystem::temp_directory_path() / "iubpatch_ips_inplace.bin").string();
+    using Mode = PatchOptions::SparseInPlace;
+    for (Mode mode : {Mode::Always, Mode::Clone, Mode::Off}) {
+        PatchOptions options;
+        options.sparse_inplace = mode;
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(source.data()), source.size());
+        auto result = patch->apply_in_place(path, options);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+
+        std::ifstream ifs(path, std::ios::binary);
+        std::vector<Byte> patched((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(patched, expected) << "mode=" << static_cast<int>(mode);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(IPSTest, OverlappingRecordsLaterWins) {
+    // random records over a 12MB source, many overlapping and some past
+    // its end, checked against writing them one after the other
+    std::vector<Byte> source(12 << 20);
+    std::uint32_t seed = 1;
+    auto next = [&seed](std::uint32_t bound) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % bound;
+    };
+    for (auto& b : source) {
+        b = static_cast<Byte>(next(256));
+    }
+
+    std::vector<Byte> expected = source;
+    std::vector<Byte> patch_data = {'P', 'A', 'T', 'C', 'H'};
+    for (int i = 0; i < 3000; ++i) {
+        // clustered near a few spots so records land on each other
+        std::uint32_t offset = (next(4) * 0x400000 + next(0x3000) * 16) & 0xFFFFFF;
+        std::uint32_t length = 1 + next(i % 3 == 0 ? 4000 : 300);
+        if (offset + length > expected.size()) {
+            expected.resize(offset + length, 0);
+        }
+        patch_data.insert(patch_data.end(), {
+            static_cast<Byte>(offset >> 16), static_cast<Byte>(offset >> 8), static_cast<Byte>(offset)
+        });
+        if (i % 5 == 0) {
+            Byte fill = static_cast<Byte>(next(256));
+            patch_data.insert(patch_data.end(), {0x00, 0x00, static_cast<Byte>(length >> 8), static_cast<Byte>(length), fill});
+            std::fill_n(expected.begin() + offset, length, fill);
+        } else {
+            patch_data.insert(patch_data.end(), {static_cast<Byte>(length >> 8), static_cast<Byte>(length)});
+            for (std::uint32_t j = 0; j < length; ++j) {
+                Byte b = static_cast<Byte>(next(256));
+                patch_data.push_back(b);
+                expected[offset + j] = b;
+            }
+        }
+    }
+    patch_data.insert(patch_data.end(), {'E', 'O', 'F'});
+
+    auto patch = IPSPatch::load(patch_data).value();
+    EXPECT_EQ(patch->get_metadata().value().target_size, expected.size());
+    for (unsigned threads : {1u, 4u}) {
+        PatchOptions options;
+        options.apply_threads = threads;
+        auto result = patch->apply(source, options);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+        EXPECT_TRUE(result.value() == expected) << "threads=" << threads;
+    }
+
+    auto path = (std::filesystem::temp_directory_path() / "iubpatch_ips_overlap.bin").string();
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(source.data()), source.size());
+    PatchOptions options;
+    options.sparse_inplace = PatchOptions::SparseInPlace::Always;
+    ASSERT_TRUE(patch->apply_in_place(path, options).is_ok());
+    EXPECT_TRUE(read_file(path).value() == expected);
+    std::filesystem::remove(path);
+}
@@ -1,9 +1,40 @@
 #include <gtest/gtest.h>
 #include "iubpatch/formats/ups.h"
+#include "iubpatch/crc32.h"
 #include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
 
 using namespace iubpatch;
 
+namespace {
+
+void append_crc(std::vector<Byte>& out, std::uint32_t crc) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<Byte>(crc >> (8 * i)));
+    }
+}
+
+void encode_num(std::vector<Byte>& out, std::uint64_t n) {
+    while (true) {
+        Byte x = n & 0x7F;
+        n >>= 7;
+        if (n == 0) {
+            out.push_back(0x80 | x);
+            break;
+        }
+        out.push_back(x);
+        --n;
+    }
+}
+
+std::vector<Byte> bytes(const std::string& s) {
+    return std::vector<Byte>(s.begin(), s.end());
+}
+
+} // namespace
+
 TEST(UPSTest, DetectFormat) {
     // UPS magic: "UPS1" + minimal valid patch
     std::vector<Byte> valid_ups = {
@@ -25,3 +56,127 @@ TEST(UPSTest, InvalidMagic) {
     auto patch_result = UPSPatch::load(invalid);
     EXPECT_FALSE(patch_result.is_ok());
 }
+
+TEST(UPSTest, ApplyGrowingTarget) {
+    auto source = bytes("Hello, World");
+    auto target = bytes("Jello, Wyrld!!");
+
+    // each hunk: relative offset, xor bytes, 0x00 (which also covers one byte)
+    std::vector<Byte> patch = {'U', 'P', 'S', '1', 0x8C, 0x8E};
+    patch.insert(patch.end(), {0x80, 'H' ^ 'J', 0x00});
+    patch.insert(patch.end(), {0x86, 'o' ^ 'y', 0x00});
+    patch.insert(patch.end(), {0x82, '!', '!', 0x00});
+    append_crc(patch, calc_crc32(source));
+    append_crc(patch, calc_crc32(target));
+    append_crc(patch, calc_crc32(patch));
+
+    auto patch_result = UPSPatch::load(patch);
+    ASSERT_TRUE(patch_result.is_ok()) << patch_result.error().message;
+    EXPECT_TRUE(patch_result.value()->validate().is_ok());
+
+    for (unsigned threads : {1u, 4u}) {
+        PatchOptions options;
+        options.checksum_threads = threads;
+        auto result = patch_result.value()->apply(source, options);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+        EXPECT_EQ(result.value(), target);
+    }
+}
+
+TEST(UPSTest, ApplyInPlaceSameSize) {
+    auto source = bytes("Hello, World");
+    auto target = bytes("Jello, Wyrld");
+
+    std::vector<Byte> patch = {'U', 'P', 'S', '1', 0x8C, 0x8C};
+    patch.insert(patch.end(), {0x80, 'H' ^ 'J', 0x00});
+    patch.insert(patch.end(), {0x86, 'o' ^ 'y', 0x00});
+    append_crc(patch, calc_crc32(source));
+    append_crc(patch, calc_crc32(target));
+    auto bad_patch = patch;
+    append_crc(patch, calc_crc32(patch));
+    // wrong target checksum, caught before anything is written
+    bad_patch[bad_patch.size() - 4] ^= 0xFF;
+    append_crc(bad_patch, calc_crc32(bad_patch));
+
+    auto path = (std::filesystem::temp_directory_path() / "iubpatch_ups_inplace.bin").string();
+    auto write = [&](const std::vector<Byte>& data) {
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+    };
+    auto read = [&] {
+        std::ifstream ifs(path, std::ios::binary);
+        return std::vector<Byte>((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    };
+
+    using Mode = PatchOptions::SparseInPlace;
+    for (Mode mode : {Mode::Always, Mode::Clone, Mode::Off}) {
+        PatchOptions options;
+        options.sparse_inplace = mode;
+        write(source);
+        auto bad = UPSPatch::load(bad_patch).value()->apply_in_place(path, options);
+        ASSERT_FALSE(bad.is_ok());
+        EXPECT_EQ(bad.error().code, ErrorCode::ChecksumMismatch);
+        EXPECT_EQ(read(), source);
+
+        auto result = UPSPatch::load(patch).value()->apply_in_place(path, options);
+        ASSERT_TRUE(result.is_ok()) << result.error().message;
+        EXPECT_EQ(read(), target) << "mode=" << static_cast<int>(mode);
+        EXPECT_FALSE(std::filesystem::exists(path + ".tmp"));
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(UPSTest, ApplyLongHunksAcrossSourceEnd) {
+    // hunk lengths straddle the vector widths, the last one runs past the source
+    std::vector<Byte> source(300), target;
+    for (std::size_t i = 0; i < source.size(); ++i) {
+        source[i] = static_cast<Byte>(i * 7 + 1);
+    }
+    target = source;
+    target.resize(420, 0);
+
+    std::vector<Byte> hunks;
+    std::size_t pos = 0;
+    for (std::size_t len : {1u, 15u, 16u, 17u, 31u, 32u, 33u, 64u, 160u}) {
+        hunks.push_back(0x83);  // skip 3 unchanged bytes
+        pos += 3;
+        for (std::size_t i = 0; i < len; ++i, ++pos) {
+            Byte x = static_cast<Byte>(i % 255 + 1);
+            target[pos] ^= x;
+            hunks.push_back(x);
+        }
+        hunks.push_back(0x00);
+        ++pos;
+    }
+    target.resize(pos);
+
+    std::vector<Byte> patch = {'U', 'P', 'S', '1'};
+    encode_num(patch, source.size());
+    encode_num(patch, target.size());
+    patch.insert(patch.end(), hunks.begin(), hunks.end());
+    append_crc(patch, calc_crc32(source));
+    append_crc(patch, calc_crc32(target));
+    append_crc(patch, calc_crc32(patch));
+
+    auto patch_result = UPSPatch::load(patch);
+    ASSERT_TRUE(patch_result.is_ok()) << patch_result.error().message;
+    auto result = patch_result.value()->apply(source);
+    ASSERT_TRUE(result.is_ok()) << result.error().message;
+    EXPECT_EQ(result.value(), target);
+}
+
+TEST(UPSTest, MalformedNumbersFailCleanly) {
+    // a target size running into the checksums
+    std::vector<Byte> truncated = {'U', 'P', 'S', '1', 0x80, 0x00, 0x00};
+    truncated.insert(truncated.end(), 12, 0xFF);
+    auto result = UPSPatch::load(truncated);
+    ASSERT_FALSE(result.is_ok());
+    EXPECT_EQ(result.error().code, ErrorCode::InvalidPatchFormat);
+
+    // a hunk offset too big for 64 bits
+    std::vector<Byte> overflow = {'U', 'P', 'S', '1', 0x80, 0x80};
+    overflow.insert(overflow.end(), {0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x81, 0x01, 0x00});
+    overflow.insert(overflow.end(), 12, 0);
+    result = UPSPatch::load(overflow);
+    ASSERT_FALSE(result.is_ok());
+    EXPECT_EQ(result.error().code, ErrorCode::InvalidPatchFormat);
+}